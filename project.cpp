@@ -4,6 +4,26 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <cmath>
+#include <climits>
+#include <cctype>
+#include <filesystem>
+#ifdef __linux__
+#include <unordered_map>
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 // ---------------------
@@ -17,6 +37,215 @@ struct Optional {
     Optional(const T &v): has(true), val(v) {}
 };
 
+#ifdef TREE_AGGREGATES
+// ---------------------
+// Range aggregates
+// ---------------------
+// Built with -DTREE_AGGREGATES, AVL and Red-Black nodes carry the
+// count/sum/min/max of the values in their subtree, kept up to date through
+// rotations and fixups, so a [a,b] query only walks two root-to-leaf paths.
+struct Aggregate {
+    long long count, sum;
+    int mn, mx;
+    Aggregate(): count(0), sum(0), mn(INT_MAX), mx(INT_MIN) {}
+    void add(int v) { count++; sum += v; mn = min(mn, v); mx = max(mx, v); }
+    void add(const Aggregate& a) { count += a.count; sum += a.sum; mn = min(mn, a.mn); mx = max(mx, a.mx); }
+};
+
+// Recomputes n's aggregate from its value and its children's aggregates.
+template<typename Node>
+void pullAggregate(Node* n) {
+    n->agg = Aggregate();
+    n->agg.add(n->value);
+    if(n->left) n->agg.add(n->left->agg);
+    if(n->right) n->agg.add(n->right->agg);
+}
+
+template<typename Node>
+Aggregate rangeAggregate(Node* n, int a, int b) {
+    Aggregate out;
+    while(n && (n->key < a || n->key > b)) n = (n->key < a) ? n->right : n->left;
+    if(!n) return out;
+    out.add(n->value);
+    // Keys >= a in the left subtree: whole right subtrees along the path.
+    for(Node* m = n->left; m; ) {
+        if(m->key >= a) { out.add(m->value); if(m->right) out.add(m->right->agg); m = m->left; }
+        else m = m->right;
+    }
+    // Keys <= b in the right subtree.
+    for(Node* m = n->right; m; ) {
+        if(m->key <= b) { out.add(m->value); if(m->left) out.add(m->left->agg); m = m->right; }
+        else m = m->left;
+    }
+    return out;
+}
+#endif
+
+// ---------------------
+// Finger search
+// ---------------------
+// Hinted operations start at a node near the key instead of the root. They
+// first walk in-order neighbours away from the hint, following at most
+// FingerWalk pointers, so a key d places from the hint costs O(1 + d) on
+// any shape, including the plain BST's degenerate spines. Keys further away
+// climb parent pointers only until the subtree can hold the key and then
+// descend, which is O(log n) on the balanced trees. A tree also remembers
+// its last hinted insert with both in-order neighbours, and its first and
+// last node once a hinted insert has landed there; a key next to the finger
+// or beyond either end is placed without any walk (see --bench finger).
+const int FingerWalk = 32;
+
+template<typename Node>
+struct Finger {
+    Node *node, *prev, *next;
+    Node *first, *last;     // null while unknown
+    Finger(): node(nullptr), prev(nullptr), next(nullptr), first(nullptr), last(nullptr) {}
+    void moveTo(Node* n, Node* p, Node* x) {
+        node = n; prev = p; next = x;
+        if(!p) first = n;
+        if(!x) last = n;
+    }
+};
+
+// Moves n to its in-order successor (forward) or predecessor, spending one
+// unit of budget per pointer followed. Returns false if the budget runs out
+// first; otherwise n is the neighbour, or null when there is none.
+template<typename Node>
+bool fingerStep(Node*& n, bool forward, int& budget) {
+    Node* c = forward ? n->right : n->left;
+    if(c) {
+        do {
+            if(--budget < 0) return false;
+            n = c;
+            c = forward ? n->left : n->right;
+        } while(c);
+        return true;
+    }
+    for(;;) {
+        if(--budget < 0) return false;
+        Node* p = n->parent;
+        bool done = !p || n == (forward ? p->left : p->right);
+        n = p;
+        if(done) return true;
+    }
+}
+
+// Climbs from n to the lowest ancestor whose key range contains k. lo/hi get
+// the nearest known range bounds (null when unbounded on that side).
+template<typename Node>
+Node* fingerClimb(Node* n, int k, Node*& lo, Node*& hi) {
+    lo = hi = nullptr;
+    if(k >= n->key) {
+        while(n->parent && !(n == n->parent->left && k < n->parent->key)) n = n->parent;
+        hi = n->parent;
+    } else {
+        while(n->parent && !(n == n->parent->right && k >= n->parent->key)) n = n->parent;
+        lo = n->parent;
+    }
+    return n;
+}
+
+// Finds the node a new key k hangs from (null for an empty tree) and on
+// which side, starting from hint or from root when hint is null. prev/next
+// receive the new key's in-order neighbours for the next finger.
+template<typename Node>
+Node* fingerSlot(Node* root, const Finger<Node>& f, Node* hint, int k, bool& goLeft, Node*& prev, Node*& next) {
+    if(hint && hint == f.node) {
+        if(k >= hint->key && (!f.next || k < f.next->key)) {
+            prev = hint; next = f.next;
+            goLeft = hint->right != nullptr;
+            return goLeft ? f.next : hint;
+        }
+        if(k < hint->key && (!f.prev || k >= f.prev->key)) {
+            prev = f.prev; next = hint;
+            goLeft = hint->left == nullptr;
+            return goLeft ? hint : f.prev;
+        }
+    }
+    if(f.last && k >= f.last->key) {
+        prev = f.last; next = nullptr; goLeft = false;
+        return f.last;
+    }
+    if(f.first && k < f.first->key) {
+        prev = nullptr; next = f.first; goLeft = true;
+        return f.first;
+    }
+    if(hint) {
+        int budget = FingerWalk;
+        Node* n = hint;
+        if(k >= hint->key) {
+            for(Node* s = n; fingerStep(s, true, budget); n = s) {
+                if(!s || k < s->key) {
+                    prev = n; next = s;
+                    goLeft = n->right != nullptr;
+                    return goLeft ? s : n;
+                }
+            }
+        } else {
+            for(Node* p = n; fingerStep(p, false, budget); n = p) {
+                if(!p || p->key <= k) {
+                    prev = p; next = n;
+                    goLeft = n->left == nullptr;
+                    return goLeft ? n : p;
+                }
+            }
+        }
+    }
+    Node* n = root;
+    prev = next = nullptr;
+    if(hint) n = fingerClimb(hint, k, prev, next);
+    Node* parent = nullptr;
+    goLeft = false;
+    while(n) {
+        parent = n;
+        goLeft = k < n->key;
+        if(goLeft) { next = n; n = n->left; }
+        else { prev = n; n = n->right; }
+    }
+    return parent;
+}
+
+// Walks in-order neighbours from the hint towards k; if k is not within
+// FingerWalk pointers, climbs to the lowest subtree whose key range holds k
+// and searches down from there, so every node on the way is visited once.
+template<typename Node>
+Node* fingerFind(Node* root, Node* hint, int k) {
+    Node* n = root;
+    if(hint) {
+        if(hint->key == k) return hint;
+        bool forward = k > hint->key;
+        int budget = FingerWalk;
+        for(Node* s = hint; fingerStep(s, forward, budget); ) {
+            if(!s || (forward ? k < s->key : k > s->key)) return nullptr;
+            if(s->key == k) return s;
+        }
+        Node *lo, *hi;
+        n = fingerClimb(hint, k, lo, hi);
+        if(lo && lo->key == k) return lo;
+    }
+    while(n && n->key != k) n = (k < n->key) ? n->left : n->right;
+    return n;
+}
+
+// ---------------------
+// Snapshot tokens
+// ---------------------
+// Each node is saved as "key:value" plus an optional tree-specific suffix
+// (an "r" colour mark or "/rank"). Snapshots written before values were
+// stored hold only the key; the value then defaults to the key. Returns
+// the offset of the suffix.
+size_t parseSnapshotToken(const string& tok, int& k, int& v) {
+    size_t pos = 0;
+    k = stoi(tok, &pos);
+    v = k;
+    if(pos < tok.size() && tok[pos] == ':') {
+        size_t len = 0;
+        v = stoi(tok.substr(pos + 1), &len);
+        pos += 1 + len;
+    }
+    return pos;
+}
+
 // ---------------------
 // BST
 // ---------------------
@@ -25,20 +254,49 @@ struct BSTNode {
     BSTNode* left;
     BSTNode* right;
     BSTNode* parent;
-    BSTNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr), parent(nullptr) {}
+    int height;     // subtree height, kept up to date by AVL
+#ifdef TREE_AGGREGATES
+    Aggregate agg;
+#endif
+    BSTNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr), parent(nullptr), height(1) {}
 };
 
+// print2D lays a tree out on a 2^height-wide grid; taller trees are
+// reported instead of drawn.
+const int MaxDrawHeight = 16;
+
 class BST {
 public:
     BSTNode* root;
-    BST(): root(nullptr) {}
+    Finger<BSTNode> finger;
+    // Rebuild mode (scapegoat): an insert that lands deeper than
+    // alpha * log2(size) rebuilds the lowest ancestor that is too deep for
+    // its own subtree size into a perfectly balanced subtree, and removals
+    // rebuild the whole tree once it has shrunk to half of maxSize. That
+    // keeps the height O(log n) and operations amortised O(log n) without
+    // per-operation rotations. size/maxSize count the BST's own inserts and
+    // removals; AVL keeps its own balance and ignores them.
+    bool rebuild;
+    double alpha;
+    int size, maxSize;
+    BST(): root(nullptr), rebuild(false), alpha(2.0), size(0), maxSize(0) {}
     virtual ~BST() { clear(root); }
 
+    // Rotates left children up instead of recursing, so even a tree that
+    // has degenerated into a list is freed without deep recursion.
     void clear(BSTNode* n) {
-        if(!n) return;
-        clear(n->left);
-        clear(n->right);
-        delete n;
+        while(n) {
+            if(n->left) {
+                BSTNode* l = n->left;
+                n->left = l->right;
+                l->right = n;
+                n = l;
+            } else {
+                BSTNode* r = n->right;
+                delete n;
+                n = r;
+            }
+        }
     }
 
     struct SearchResult {
@@ -61,19 +319,50 @@ public:
 
     virtual void insert(int k, int v) {
         BSTNode* node = new BSTNode(k,v);
-        if(!root) { root = node; return; }
+        finger = Finger<BSTNode>();
+        if(!root) { root = node; grown(node, 0); return; }
         BSTNode* cur = root;
         BSTNode* par = nullptr;
-        while(cur) { par = cur; cur = (k < cur->key) ? cur->left : cur->right; }
+        int depth = 0;
+        while(cur) { par = cur; cur = (k < cur->key) ? cur->left : cur->right; depth++; }
         node->parent = par;
         if(k < par->key) par->left = node;
         else par->right = node;
+        grown(node, depth);
+    }
+
+    // Inserts starting from hint, any node of this tree (null means the
+    // root), and returns the new node, which is the natural hint for the
+    // next key of an ascending or nearly sorted stream.
+    virtual BSTNode* insertHint(BSTNode* hint, int k, int v) {
+        bool goLeft;
+        BSTNode *prev, *next;
+        BSTNode* par = fingerSlot(root, finger, hint, k, goLeft, prev, next);
+        BSTNode* node = new BSTNode(k,v);
+        attach(node, par, goLeft);
+        finger.moveTo(node, prev, next);
+        int depth = 0;
+        if(rebuild) for(BSTNode* n = node; n->parent; n = n->parent) depth++;
+        grown(node, depth);
+        return node;
+    }
+
+    BSTNode* searchHint(BSTNode* hint, int k) {
+        return fingerFind(root, hint, k);
+    }
+
+    void attach(BSTNode* node, BSTNode* par, bool goLeft) {
+        node->parent = par;
+        if(!par) root = node;
+        else if(goLeft) par->left = node;
+        else par->right = node;
     }
 
     virtual bool remove(int k) {
         BSTNode* z = root;
         while(z && z->key != k) z = (k < z->key) ? z->left : z->right;
         if(!z) return false;
+        finger = Finger<BSTNode>();
 
         if(!z->left) transplant(z, z->right);
         else if(!z->right) transplant(z, z->left);
@@ -89,9 +378,94 @@ public:
             if(y->left) y->left->parent = y;
         }
         delete z;
+        size--;
+        if(rebuild && root && size * 2 < maxSize) {
+            rebuildSubtree(root, size);
+            maxSize = size;
+        }
         return true;
     }
 
+    int depthLimit(int n) {
+        return (int)(alpha * log2((double)max(n, 2)));
+    }
+
+    // Called after node was attached at the given depth (only counted in
+    // rebuild mode). Walks up summing subtree sizes until an ancestor is
+    // deeper above node than its subtree size allows; one must exist, since
+    // the root itself fails the test.
+    void grown(BSTNode* node, int depth) {
+        size++;
+        maxSize = max(maxSize, size);
+        if(!rebuild || depth <= depthLimit(size)) return;
+        int sub = 1, up = 0;
+        for(BSTNode* c = node; c->parent; c = c->parent) {
+            BSTNode* p = c->parent;
+            sub += 1 + subtreeSize(p->left == c ? p->right : p->left);
+            up++;
+            if(up > depthLimit(sub)) { rebuildSubtree(p, sub); return; }
+        }
+    }
+
+    int subtreeSize(BSTNode* n) {
+        int count = 0;
+        vector<BSTNode*> stack;
+        if(n) stack.push_back(n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            count++;
+            if(n->left) stack.push_back(n->left);
+            if(n->right) stack.push_back(n->right);
+        }
+        return count;
+    }
+
+    // Rebuilds the n-node subtree at sub into perfect balance in place:
+    // rotations first flatten it into a sorted right-leaning list (the
+    // Day-Stout-Warren "vine"), which is then split back up by halves.
+    // Nodes are relinked, never allocated or copied, so fingers stay valid.
+    void rebuildSubtree(BSTNode* sub, int n) {
+        BSTNode* par = sub->parent;
+        bool wasLeft = par && par->left == sub;
+        BSTNode* head = toVine(sub);
+        BSTNode* top = fromVine(head, n);
+        top->parent = par;
+        if(!par) root = top;
+        else if(wasLeft) par->left = top;
+        else par->right = top;
+    }
+
+    BSTNode* toVine(BSTNode* n) {
+        BSTNode head;
+        BSTNode* tail = &head;
+        while(n) {
+            if(n->left) {
+                BSTNode* l = n->left;
+                n->left = l->right;
+                l->right = n;
+                n = l;
+            } else {
+                tail->right = n;
+                tail = n;
+                n = n->right;
+            }
+        }
+        return head.right;
+    }
+
+    // Takes the first n nodes off the vine; recursion depth is log2(n).
+    BSTNode* fromVine(BSTNode*& vine, int n) {
+        if(n == 0) return nullptr;
+        BSTNode* l = fromVine(vine, (n - 1) / 2);
+        BSTNode* mid = vine;
+        vine = vine->right;
+        mid->left = l;
+        if(l) l->parent = mid;
+        mid->right = fromVine(vine, n - 1 - (n - 1) / 2);
+        if(mid->right) mid->right->parent = mid;
+        return mid;
+    }
+
     void transplant(BSTNode* u, BSTNode* v) {
         if(!u->parent) root = v;
         else if(u->parent->left == u) u->parent->left = v;
@@ -104,39 +478,63 @@ public:
         return n;
     }
 
+    // Unsorted input can leave the plain BST as a path of n nodes, so every
+    // whole-tree walk keeps an explicit stack.
     void inorder(BSTNode* n, vector<int>& out) {
-        if(!n) return;
-        inorder(n->left, out);
-        out.push_back(n->key);
-        inorder(n->right, out);
+        vector<BSTNode*> stack;
+        while(n || !stack.empty()) {
+            while(n) { stack.push_back(n); n = n->left; }
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            n = n->right;
+        }
     }
     vector<int> inorderKeys() {
         vector<int> v; inorder(root,v); return v;
     }
 
     void preorder(BSTNode* n, vector<int>& out) {
-        if(!n) return;
-        out.push_back(n->key);
-        preorder(n->left, out);
-        preorder(n->right, out);
+        vector<BSTNode*> stack;
+        if(n) stack.push_back(n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            if(n->right) stack.push_back(n->right);
+            if(n->left) stack.push_back(n->left);
+        }
     }
     vector<int> preorderKeys() {
         vector<int> v; preorder(root,v); return v;
     }
 
+    // Root-right-left order, reversed, is left-right-root.
     void postorder(BSTNode* n, vector<int>& out) {
-        if(!n) return;
-        postorder(n->left, out);
-        postorder(n->right, out);
-        out.push_back(n->key);
+        size_t start = out.size();
+        vector<BSTNode*> stack;
+        if(n) stack.push_back(n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            if(n->left) stack.push_back(n->left);
+            if(n->right) stack.push_back(n->right);
+        }
+        reverse(out.begin() + start, out.end());
     }
     vector<int> postorderKeys() {
         vector<int> v; postorder(root,v); return v;
     }
 
     int getHeight(BSTNode* n) {
-        if(!n) return 0;
-        return 1 + max(getHeight(n->left), getHeight(n->right));
+        int h = 0;
+        vector<pair<BSTNode*,int>> stack;
+        if(n) stack.push_back({n, 1});
+        while(!stack.empty()) {
+            pair<BSTNode*,int> top = stack.back(); stack.pop_back();
+            h = max(h, top.second);
+            if(top.first->left) stack.push_back({top.first->left, top.second + 1});
+            if(top.first->right) stack.push_back({top.first->right, top.second + 1});
+        }
+        return h;
     }
 
     int getWidth(BSTNode* n) {
@@ -172,6 +570,7 @@ public:
     void print2D() { 
         if(!root) { cout << "Tree is empty.\n"; return; }
         int h = getHeight(root);
+        if(h > MaxDrawHeight) { cout << "Tree height " << h << " is too tall to draw; use Traverse to list the keys.\n"; return; }
         int w = getWidth(root);
         int rows = h * 2 - 1;
         
@@ -190,32 +589,88 @@ public:
         ofstream ofs(filename);
         savePre(root, ofs);
     }
-    void savePre(BSTNode* n, ofstream& ofs) {
-        if(!n) { ofs<<"# "; return; }
-        ofs<<n->key<<" ";
-        savePre(n->left, ofs);
-        savePre(n->right, ofs);
+    void savePre(BSTNode* n, ostream& ofs) {
+        vector<BSTNode*> stack(1, n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            if(!n) { ofs<<"# "; continue; }
+            ofs<<n->key<<":"<<n->value<<" ";
+            stack.push_back(n->right);
+            stack.push_back(n->left);
+        }
     }
     void loadFromFile(const string& filename) {
         ifstream ifs(filename);
+        loadFrom(ifs);
+    }
+    void loadFrom(istream& ifs) {
         clear(root);
+        finger = Finger<BSTNode>();
+        size = 0;
         root = loadPre(ifs, nullptr);
-    }
-    BSTNode* loadPre(ifstream& ifs, BSTNode* parent) {
+        maxSize = size;
+        if(rebuild && root) rebuildSubtree(root, size);
+    }
+    // Keeps a stack of the child links still to be filled, in preorder.
+    // Heights (and aggregates) are set afterwards in reverse preorder, which
+    // reaches every child before its parent.
+    BSTNode* loadPre(istream& ifs, BSTNode* parent) {
+        BSTNode* top = nullptr;
+        vector<pair<BSTNode**,BSTNode*>> slots(1, {&top, parent});
+        vector<BSTNode*> loaded;
         string tok;
-        if(!(ifs >> tok)) return nullptr;
-        if(tok == "#") return nullptr;
-        int k = stoi(tok);
-        BSTNode* n = new BSTNode(k,k);
-        n->parent = parent;
-        n->left = loadPre(ifs, n);
-        n->right = loadPre(ifs, n);
-        return n;
+        while(!slots.empty() && ifs >> tok) {
+            pair<BSTNode**,BSTNode*> slot = slots.back(); slots.pop_back();
+            if(tok == "#") continue;
+            int k, v;
+            parseSnapshotToken(tok, k, v);
+            BSTNode* n = new BSTNode(k,v);
+            size++;
+            n->parent = slot.second;
+            *slot.first = n;
+            loaded.push_back(n);
+            slots.push_back({&n->right, n});
+            slots.push_back({&n->left, n});
+        }
+        for(size_t i = loaded.size(); i-- > 0; ) {
+            setHeight(loaded[i]);
+#ifdef TREE_AGGREGATES
+            pullAggregate(loaded[i]);
+#endif
+        }
+        return top;
+    }
+
+    void setHeight(BSTNode* n) {
+        n->height = 1 + max(n->left ? n->left->height : 0, n->right ? n->right->height : 0);
     }
 
     void clearTree() {
         clear(root);
         root = nullptr;
+        finger = Finger<BSTNode>();
+        size = maxSize = 0;
+    }
+
+    // Replaces the tree with a perfectly balanced one built from sorted pairs.
+    void bulkLoad(const vector<pair<int,int>>& kv) {
+        clear(root);
+        finger = Finger<BSTNode>();
+        size = maxSize = (int)kv.size();
+        root = buildSorted(kv, 0, (int)kv.size() - 1, nullptr);
+    }
+    BSTNode* buildSorted(const vector<pair<int,int>>& kv, int lo, int hi, BSTNode* parent) {
+        if(lo > hi) return nullptr;
+        int mid = lo + (hi - lo) / 2;
+        BSTNode* n = new BSTNode(kv[mid].first, kv[mid].second);
+        n->parent = parent;
+        n->left = buildSorted(kv, lo, mid - 1, n);
+        n->right = buildSorted(kv, mid + 1, hi, n);
+        setHeight(n);
+#ifdef TREE_AGGREGATES
+        pullAggregate(n);
+#endif
+        return n;
     }
 };
 
@@ -224,9 +679,10 @@ public:
 // ---------------------
 class AVL : public BST {
 public:
+    long long rotations = 0;
+
     int height(BSTNode* n) {
-        if(!n) return 0;
-        return 1 + max(height(n->left), height(n->right));
+        return n ? n->height : 0;
     }
 
     int balanceFactor(BSTNode* n) {
@@ -236,6 +692,7 @@ public:
     BSTNode* rightRotate(BSTNode* y) {
         BSTNode* x = y->left;
         BSTNode* T2 = x->right;
+        rotations++;
 
         x->right = y;
         y->left = T2;
@@ -247,6 +704,12 @@ public:
         if(!x->parent) root = x;
         else if(x->parent->left == y) x->parent->left = x;
         else x->parent->right = x;
+        setHeight(y);
+        setHeight(x);
+#ifdef TREE_AGGREGATES
+        pullAggregate(y);
+        pullAggregate(x);
+#endif
 
         return x;
     }
@@ -254,6 +717,7 @@ public:
     BSTNode* leftRotate(BSTNode* x) {
         BSTNode* y = x->right;
         BSTNode* T2 = y->left;
+        rotations++;
 
         y->left = x;
         x->right = T2;
@@ -265,6 +729,12 @@ public:
         if(!y->parent) root = y;
         else if(y->parent->left == x) y->parent->left = y;
         else y->parent->right = y;
+        setHeight(x);
+        setHeight(y);
+#ifdef TREE_AGGREGATES
+        pullAggregate(x);
+        pullAggregate(y);
+#endif
 
         return y;
     }
@@ -289,17 +759,50 @@ public:
     }
 
     BSTNode* insertRec(BSTNode* node, int k, int v, BSTNode* parent) {
-        if(!node) { BSTNode* n = new BSTNode(k,v); n->parent = parent; return n; }
+        if(!node) {
+            BSTNode* n = new BSTNode(k,v); n->parent = parent;
+#ifdef TREE_AGGREGATES
+            pullAggregate(n);
+#endif
+            return n;
+        }
         if(k < node->key) node->left = insertRec(node->left, k, v, node);
         else node->right = insertRec(node->right, k, v, node);
+        setHeight(node);
+#ifdef TREE_AGGREGATES
+        pullAggregate(node);
+#endif
         return rebalance(node);
     }
 
     void insert(int k, int v) override {
+        finger = Finger<BSTNode>();
         root = insertRec(root, k, v, nullptr);
         if(root) root->parent = nullptr;
     }
 
+    // Attaches next to the hint, then retraces upwards with the cached
+    // heights; the retrace stops once a subtree keeps its old height, which
+    // for sequential keys is a constant number of levels on average.
+    BSTNode* insertHint(BSTNode* hint, int k, int v) override {
+        bool goLeft;
+        BSTNode *prev, *next;
+        BSTNode* par = fingerSlot(root, finger, hint, k, goLeft, prev, next);
+        BSTNode* node = new BSTNode(k,v);
+        attach(node, par, goLeft);
+        for(BSTNode* n = par; n; n = n->parent) {
+            int before = n->height;
+            setHeight(n);
+            n = rebalance(n);
+            if(n->height == before) break;
+        }
+#ifdef TREE_AGGREGATES
+        for(BSTNode* n = node; n; n = n->parent) pullAggregate(n);
+#endif
+        finger.moveTo(node, prev, next);
+        return node;
+    }
+
     BSTNode* removeRec(BSTNode* node, int k) {
         if(!node) return nullptr;
         if(k < node->key) node->left = removeRec(node->left, k);
@@ -316,10 +819,18 @@ public:
                 node->right = removeRec(node->right, succ->key);
             }
         }
+        setHeight(node);
+#ifdef TREE_AGGREGATES
+        pullAggregate(node);
+#endif
         return rebalance(node);
     }
 
     bool remove(int k) override {
+        BSTNode* z = root;
+        while(z && z->key != k) z = (k < z->key) ? z->left : z->right;
+        if(!z) return false;
+        finger = Finger<BSTNode>();
         root = removeRec(root,k);
         if(root) root->parent=nullptr;
         return true;
@@ -334,13 +845,18 @@ public:
     int key, value;
     RBNode *left, *right, *parent;
     bool red;
+#ifdef TREE_AGGREGATES
+    Aggregate agg;
+#endif
     RBNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr), parent(nullptr), red(true) {}
 };
 
 class RBTree {
 public:
     RBNode* root;
-    RBTree(): root(nullptr) {}
+    long long rotations;
+    Finger<RBNode> finger;
+    RBTree(): root(nullptr), rotations(0) {}
     ~RBTree() { clear(root); }
 
     void clear(RBNode* n) {
@@ -370,6 +886,7 @@ public:
 
     void leftRotate(RBNode* x) {
         RBNode* y = x->right;
+        rotations++;
         x->right = y->left;
         if(y->left) y->left->parent = x;
         y->parent = x->parent;
@@ -378,10 +895,15 @@ public:
         else x->parent->right = y;
         y->left = x;
         x->parent = y;
+#ifdef TREE_AGGREGATES
+        pullAggregate(x);
+        pullAggregate(y);
+#endif
     }
 
     void rightRotate(RBNode* y) {
         RBNode* x = y->left;
+        rotations++;
         y->left = x->right;
         if(x->right) x->right->parent = y;
         x->parent = y->parent;
@@ -390,10 +912,15 @@ public:
         else y->parent->right = x;
         x->right = y;
         y->parent = x;
+#ifdef TREE_AGGREGATES
+        pullAggregate(y);
+        pullAggregate(x);
+#endif
     }
 
     void insert(int k, int v) {
         RBNode* z = new RBNode(k,v);
+        finger = Finger<RBNode>();
         RBNode *y = nullptr, *x = root;
         while(x) { y=x; x=(z->key<x->key)?x->left:x->right; }
         z->parent=y;
@@ -401,7 +928,33 @@ public:
         else if(z->key<y->key) y->left=z;
         else y->right=z;
         z->left=z->right=nullptr; z->red=true;
+#ifdef TREE_AGGREGATES
+        for(RBNode* p = z; p; p = p->parent) pullAggregate(p);
+#endif
+        insertFixup(z);
+    }
+
+    // Hinted insert, see BST::insertHint. Fixup recolours and rotates but
+    // never changes in-order neighbours, so the finger stays valid.
+    RBNode* insertHint(RBNode* hint, int k, int v) {
+        bool goLeft;
+        RBNode *prev, *next;
+        RBNode* y = fingerSlot(root, finger, hint, k, goLeft, prev, next);
+        RBNode* z = new RBNode(k,v);
+        z->parent = y;
+        if(!y) root = z;
+        else if(goLeft) y->left = z;
+        else y->right = z;
+#ifdef TREE_AGGREGATES
+        for(RBNode* p = z; p; p = p->parent) pullAggregate(p);
+#endif
         insertFixup(z);
+        finger.moveTo(z, prev, next);
+        return z;
+    }
+
+    RBNode* searchHint(RBNode* hint, int k) {
+        return fingerFind(root, hint, k);
     }
 
     void insertFixup(RBNode* z) {
@@ -498,6 +1051,7 @@ public:
         RBNode* z = root;
         while(z && z->key != k) z = (k < z->key) ? z->left : z->right;
         if(!z) return false;
+        finger = Finger<RBNode>();
 
         RBNode* y = z;
         RBNode* x;
@@ -532,6 +1086,9 @@ public:
             y->red = z->red;
         }
         delete z;
+#ifdef TREE_AGGREGATES
+        for(RBNode* p = xParent; p; p = p->parent) pullAggregate(p);
+#endif
         if(!yOriginalRed) deleteFixup(x, xParent);
         return true;
     }
@@ -619,143 +1176,1630 @@ public:
         ofstream ofs(filename);
         savePre(root,ofs);
     }
-    void savePre(RBNode* n, ofstream &ofs) {
+    // Red nodes get an "r" suffix; without colours a reloaded tree breaks the
+    // black-height rule and deleteFixup can meet a missing sibling.
+    void savePre(RBNode* n, ostream &ofs) {
         if(!n) { ofs<<"# "; return; }
-        ofs<<n->key<<" ";
+        ofs<<n->key<<":"<<n->value<<(n->red ? "r " : " ");
         savePre(n->left,ofs);
         savePre(n->right,ofs);
     }
     void loadFromFile(const string &filename) {
         ifstream ifs(filename);
+        loadFrom(ifs);
+    }
+    void loadFrom(istream& ifs) {
         clear(root);
+        finger = Finger<RBNode>();
         root = loadPre(ifs,nullptr);
         if(root) root->red=false;
     }
-    RBNode* loadPre(ifstream &ifs,RBNode* parent) {
+    RBNode* loadPre(istream &ifs,RBNode* parent) {
         string tok; if(!(ifs>>tok)) return nullptr;
         if(tok=="#") return nullptr;
-        int k=stoi(tok);
-        RBNode* n=new RBNode(k,k);
+        int k, v;
+        parseSnapshotToken(tok, k, v);
+        RBNode* n=new RBNode(k,v);
+        n->red=(tok.back()=='r');
         n->parent=parent;
         n->left=loadPre(ifs,n);
         n->right=loadPre(ifs,n);
+#ifdef TREE_AGGREGATES
+        pullAggregate(n);
+#endif
         return n;
     }
 
     void clearTree() {
         clear(root);
         root = nullptr;
+        finger = Finger<RBNode>();
+    }
+
+    // Builds a balanced tree from sorted pairs. Every leaf sits on one of the
+    // two deepest levels, so colouring the deepest level red keeps all
+    // black-heights equal.
+    void bulkLoad(const vector<pair<int,int>>& kv) {
+        clear(root);
+        finger = Finger<RBNode>();
+        int redDepth = 0;
+        while((2 << redDepth) <= (int)kv.size()) redDepth++;
+        root = buildSorted(kv, 0, (int)kv.size() - 1, nullptr, 0, redDepth);
+        if(root) root->red = false;
+    }
+    RBNode* buildSorted(const vector<pair<int,int>>& kv, int lo, int hi, RBNode* parent, int depth, int redDepth) {
+        if(lo > hi) return nullptr;
+        int mid = lo + (hi - lo) / 2;
+        RBNode* n = new RBNode(kv[mid].first, kv[mid].second);
+        n->parent = parent;
+        n->red = (depth == redDepth);
+        n->left = buildSorted(kv, lo, mid - 1, n, depth + 1, redDepth);
+        n->right = buildSorted(kv, mid + 1, hi, n, depth + 1, redDepth);
+#ifdef TREE_AGGREGATES
+        pullAggregate(n);
+#endif
+        return n;
     }
 };
 
 // ---------------------
-// TreeManager
+// Top-down Red-Black
 // ---------------------
+// Single-pass variant: insert splits 4-nodes and remove pushes a red node
+// down on the way to the leaf, so neither needs a second walk back up or a
+// parent pointer. Based on the top-down algorithms in Guibas & Sedgewick.
+class TDRBNode {
+public:
+    int key, value;
+    TDRBNode *left, *right;
+    bool red;
+    TDRBNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr), red(true) {}
+};
 
-class TreeManager {
+class TDRBTree {
 public:
-    BST bst;
-    AVL avl;
-    RBTree rb;
+    TDRBNode* root;
+    TDRBTree(): root(nullptr) {}
+    ~TDRBTree() { clear(root); }
 
-    enum TreeType { BSTType, AVLType, RBType };
-    TreeType currentTree = BSTType;
-    
-    void setTree(TreeType t) {
-        currentTree = t;
+    void clear(TDRBNode* n) {
+        if(!n) return;
+        clear(n->left);
+        clear(n->right);
+        delete n;
     }
 
-    void insert(int key) {
-        switch (currentTree) {
-        case BSTType:
-            bst.insert(key, key);
-            bst.saveToFile("bst.txt");
-            bst.print2D();
-            break;
-        case AVLType:
-            avl.insert(key, key);
-            avl.saveToFile("avl.txt");
-            avl.print2D();
-            break;
-        case RBType:
-            rb.insert(key, key);
-            rb.saveToFile("rb.txt");
-            rb.print2D();
-            break;
+    struct SearchResult {
+        bool found;
+        int depth;
+        SearchResult(): found(false), depth(0) {}
+        SearchResult(bool f, int d): found(f), depth(d) {}
+    };
+
+    SearchResult search(int k) {
+        TDRBNode* cur = root;
+        int depth = 0;
+        while(cur) {
+            if(cur->key==k) return SearchResult(true, depth);
+            cur = (k < cur->key) ? cur->left : cur->right;
+            depth++;
         }
-        cout<<"Press any key to continue...";
-        cin.ignore();
-        cin.get();
-        clearScreen();
+        return SearchResult(false, -1);
     }
 
-    void remove(int key) {
-        switch (currentTree) {
-        case BSTType:
-            bst.remove(key);
-            bst.saveToFile("bst.txt");
-            bst.print2D();
-            break;
-        case AVLType:
-            avl.remove(key);
-            avl.saveToFile("avl.txt");
-            avl.print2D();
-            break;
-        case RBType:
-            rb.remove(key);
-            rb.saveToFile("rb.txt");
-            rb.print2D();
-            break;
+    static bool isRed(TDRBNode* n) { return n && n->red; }
+
+    // dir 0 is left, 1 is right.
+    static TDRBNode*& link(TDRBNode* n, int dir) { return dir ? n->right : n->left; }
+
+    // Rotates n towards dir and returns the new subtree root.
+    static TDRBNode* rotate(TDRBNode* n, int dir) {
+        TDRBNode* save = link(n, !dir);
+        link(n, !dir) = link(save, dir);
+        link(save, dir) = n;
+        n->red = true;
+        save->red = false;
+        return save;
+    }
+
+    static TDRBNode* rotate2(TDRBNode* n, int dir) {
+        link(n, !dir) = rotate(link(n, !dir), !dir);
+        return rotate(n, dir);
+    }
+
+    void insert(int k, int v) {
+        TDRBNode* fresh = new TDRBNode(k,v);
+        if(!root) { root = fresh; root->red = false; return; }
+
+        TDRBNode head;  // false root above the real one
+        TDRBNode *t = &head, *g = nullptr, *p = nullptr, *q = root;
+        head.right = root;
+        int dir = 0, last = 0;
+        while(true) {
+            if(!q) link(p, dir) = q = fresh;
+            else if(isRed(q->left) && isRed(q->right)) {
+                q->red = true;
+                q->left->red = q->right->red = false;
+            }
+            if(isRed(q) && isRed(p)) {
+                int dir2 = (t->right == g);
+                if(q == link(p, last)) link(t, dir2) = rotate(g, !last);
+                else link(t, dir2) = rotate2(g, !last);
+            }
+            if(q == fresh) break;
+            last = dir;
+            dir = !(k < q->key);
+            if(g) t = g;
+            g = p; p = q; q = link(q, dir);
         }
-        cout<<"Press any key to continue...";
-        cin.ignore();
-        cin.get();
-        clearScreen();
+        root = head.right;
+        root->red = false;
     }
 
-    void search(int key) {
-        BST::SearchResult result;
-        AVL::SearchResult result2;
-        RBTree::SearchResult result3;
-        
-        switch (currentTree) {
-        case BSTType:
-            result = bst.search(key);
-            break;
-        case AVLType:
-            result2 = avl.search(key);
-            result.found = result2.found;
-            result.depth = result2.depth;
-            break;
-        case RBType:
-            result3 = rb.search(key);
-            result.found = result3.found;
-            result.depth = result3.depth;
-            break;
+    // Walks to the in-order predecessor of k (or the leaf where it would be)
+    // keeping the current node red, then splices that node out.
+    bool remove(int k) {
+        if(!root) return false;
+
+        TDRBNode head;
+        TDRBNode *q = &head, *p = nullptr, *g = nullptr, *f = nullptr;
+        head.right = root;
+        int dir = 1;
+        while(link(q, dir)) {
+            int last = dir;
+            g = p; p = q; q = link(q, dir);
+            dir = q->key < k;
+            if(q->key == k) f = q;
+
+            if(!isRed(q) && !isRed(link(q, dir))) {
+                if(isRed(link(q, !dir))) p = link(p, last) = rotate(q, dir);
+                else {
+                    TDRBNode* s = link(p, !last);
+                    if(s) {
+                        if(!isRed(s->left) && !isRed(s->right)) {
+                            p->red = false;
+                            s->red = true;
+                            q->red = true;
+                        } else {
+                            int dir2 = (g->right == p);
+                            if(isRed(link(s, last))) link(g, dir2) = rotate2(p, last);
+                            else link(g, dir2) = rotate(p, last);
+                            TDRBNode* r = link(g, dir2);
+                            q->red = r->red = true;
+                            r->left->red = r->right->red = false;
+                        }
+                    }
+                }
+            }
         }
-        
-        if(result.found) {
-            cout << "Found at depth: " << result.depth << " (height from root: " << result.depth << ")\n";
-        } else {
-            cout << "Not found\n";
+        if(f) {
+            f->key = q->key;
+            f->value = q->value;
+            link(p, p->right == q) = link(q, q->left == nullptr);
+            delete q;
         }
-        cout<<"Press any key to continue...";
-        cin.ignore();
-        cin.get();
-        clearScreen();
+        root = head.right;
+        if(root) root->red = false;
+        return f != nullptr;
     }
 
-    void traverse() {
-        cout<<"\n====================\n";
-        cout<<"Select Traversal Type:\n";
-        cout<<"1. Preorder\n";
-        cout<<"2. Inorder\n";
+    void inorder(TDRBNode* n, vector<int>& out) {
+        if(!n) return;
+        inorder(n->left,out);
+        out.push_back(n->key);
+        inorder(n->right,out);
+    }
+
+    vector<int> inorderKeys() { vector<int> v; inorder(root,v); return v; }
+
+    void preorder(TDRBNode* n, vector<int>& out) {
+        if(!n) return;
+        out.push_back(n->key);
+        preorder(n->left,out);
+        preorder(n->right,out);
+    }
+
+    vector<int> preorderKeys() { vector<int> v; preorder(root,v); return v; }
+
+    void postorder(TDRBNode* n, vector<int>& out) {
+        if(!n) return;
+        postorder(n->left,out);
+        postorder(n->right,out);
+        out.push_back(n->key);
+    }
+
+    vector<int> postorderKeys() { vector<int> v; postorder(root,v); return v; }
+
+    int getHeight(TDRBNode* n) {
+        if(!n) return 0;
+        return 1 + max(getHeight(n->left), getHeight(n->right));
+    }
+
+    int getWidth(TDRBNode* n) {
+        if(!n) return 0;
+        int h = getHeight(n);
+        return (1 << h) - 1;
+    }
+
+    void fillMatrix(TDRBNode* n, vector<vector<string>>& matrix, int row, int left, int right) {
+        if(!n) return;
+        int mid = (left + right) / 2;
+        matrix[row][mid] = to_string(n->key) + (n->red ? "(R)" : "(B)");
+
+        if(n->left || n->right) {
+            int branchRow = row + 1;
+            if(n->left) {
+                int leftMid = (left + mid - 1) / 2;
+                matrix[branchRow][leftMid] = "/";
+                fillMatrix(n->left, matrix, row + 2, left, mid - 1);
+            }
+            if(n->right) {
+                int rightMid = (mid + 1 + right) / 2;
+                matrix[branchRow][rightMid] = "\\";
+                fillMatrix(n->right, matrix, row + 2, mid + 1, right);
+            }
+        }
+    }
+
+    void print2D() {
+        if(!root) { cout << "Tree is empty.\n"; return; }
+        int h = getHeight(root);
+        int w = getWidth(root);
+        int rows = h * 2 - 1;
+
+        vector<vector<string>> matrix(rows, vector<string>(w, " "));
+        fillMatrix(root, matrix, 0, 0, w - 1);
+
+        for(int i = 0; i < rows; i++) {
+            for(int j = 0; j < w; j++) {
+                cout << matrix[i][j];
+            }
+            cout << "\n";
+        }
+    }
+
+    // Red nodes are written with an "r" suffix so colours survive a reload.
+    void saveToFile(const string &filename) {
+        ofstream ofs(filename);
+        savePre(root,ofs);
+    }
+    void savePre(TDRBNode* n, ostream &ofs) {
+        if(!n) { ofs<<"# "; return; }
+        ofs<<n->key<<":"<<n->value<<(n->red ? "r " : " ");
+        savePre(n->left,ofs);
+        savePre(n->right,ofs);
+    }
+    void loadFromFile(const string &filename) {
+        ifstream ifs(filename);
+        loadFrom(ifs);
+    }
+    void loadFrom(istream& ifs) {
+        clear(root);
+        root = loadPre(ifs);
+        if(root) root->red=false;
+    }
+    TDRBNode* loadPre(istream &ifs) {
+        string tok; if(!(ifs>>tok)) return nullptr;
+        if(tok=="#") return nullptr;
+        int k, v;
+        parseSnapshotToken(tok, k, v);
+        TDRBNode* n=new TDRBNode(k,v);
+        n->red = (tok.back()=='r');
+        n->left=loadPre(ifs);
+        n->right=loadPre(ifs);
+        return n;
+    }
+
+    void clearTree() {
+        clear(root);
+        root = nullptr;
+    }
+
+    void bulkLoad(const vector<pair<int,int>>& kv) {
+        clear(root);
+        int redDepth = 0;
+        while((2 << redDepth) <= (int)kv.size()) redDepth++;
+        root = buildSorted(kv, 0, (int)kv.size() - 1, 0, redDepth);
+        if(root) root->red = false;
+    }
+    TDRBNode* buildSorted(const vector<pair<int,int>>& kv, int lo, int hi, int depth, int redDepth) {
+        if(lo > hi) return nullptr;
+        int mid = lo + (hi - lo) / 2;
+        TDRBNode* n = new TDRBNode(kv[mid].first, kv[mid].second);
+        n->red = (depth == redDepth);
+        n->left = buildSorted(kv, lo, mid - 1, depth + 1, redDepth);
+        n->right = buildSorted(kv, mid + 1, hi, depth + 1, redDepth);
+        return n;
+    }
+};
+
+// ---------------------
+// WAVL (rank-balanced)
+// ---------------------
+// Weak AVL tree (Haeupler, Sen & Tarjan). Every node stores a rank and
+// every rank difference to a child is 1 or 2 (a missing child has rank -1,
+// so leaves have rank 0). With inserts only it is an AVL tree; a delete
+// does at most two rotations, and rebalancing work is O(1) amortized.
+class WAVLNode {
+public:
+    int key, value;
+    WAVLNode *left, *right, *parent;
+    int rank;
+    WAVLNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr), parent(nullptr), rank(0) {}
+};
+
+class WAVLTree {
+public:
+    WAVLNode* root;
+    long long rotations;
+    WAVLTree(): root(nullptr), rotations(0) {}
+    ~WAVLTree() { clear(root); }
+
+    void clear(WAVLNode* n) {
+        if(!n) return;
+        clear(n->left);
+        clear(n->right);
+        delete n;
+    }
+
+    struct SearchResult {
+        bool found;
+        int depth;
+        SearchResult(): found(false), depth(0) {}
+        SearchResult(bool f, int d): found(f), depth(d) {}
+    };
+
+    SearchResult search(int k) {
+        WAVLNode* cur = root;
+        int depth = 0;
+        while(cur) {
+            if(cur->key==k) return SearchResult(true, depth);
+            cur = (k < cur->key) ? cur->left : cur->right;
+            depth++;
+        }
+        return SearchResult(false, -1);
+    }
+
+    static int rank(WAVLNode* n) { return n ? n->rank : -1; }
+
+    // Rotates x above its parent.
+    void rotateUp(WAVLNode* x) {
+        WAVLNode* p = x->parent;
+        WAVLNode* g = p->parent;
+        if(x == p->left) {
+            p->left = x->right;
+            if(x->right) x->right->parent = p;
+            x->right = p;
+        } else {
+            p->right = x->left;
+            if(x->left) x->left->parent = p;
+            x->left = p;
+        }
+        p->parent = x;
+        x->parent = g;
+        if(!g) root = x;
+        else if(g->left == p) g->left = x;
+        else g->right = x;
+        rotations++;
+    }
+
+    void insert(int k, int v) {
+        WAVLNode* z = new WAVLNode(k,v);
+        WAVLNode *y = nullptr, *x = root;
+        while(x) { y=x; x=(k<x->key)?x->left:x->right; }
+        z->parent=y;
+        if(!y) root=z;
+        else if(k<y->key) y->left=z;
+        else y->right=z;
+        insertFixup(z);
+    }
+
+    // x is a 0-child after an insert: promote until the difference is back
+    // to 1 or 2, or finish with a single or double rotation.
+    void insertFixup(WAVLNode* x) {
+        WAVLNode* p = x->parent;
+        while(p && p->rank == x->rank) {
+            WAVLNode* s = (x == p->left) ? p->right : p->left;
+            if(p->rank - rank(s) == 1) {
+                p->rank++;
+                x = p;
+                p = p->parent;
+                continue;
+            }
+            WAVLNode* y = (x == p->left) ? x->right : x->left;
+            if(x->rank - rank(y) == 2) {
+                rotateUp(x);
+                p->rank--;
+            } else {
+                rotateUp(y);
+                rotateUp(y);
+                y->rank++;
+                x->rank--;
+                p->rank--;
+            }
+            break;
+        }
+    }
+
+    WAVLNode* minimum(WAVLNode* n) {
+        while(n && n->left) n = n->left;
+        return n;
+    }
+
+    void transplant(WAVLNode* u, WAVLNode* v) {
+        if(!u->parent) root = v;
+        else if(u == u->parent->left) u->parent->left = v;
+        else u->parent->right = v;
+        if(v) v->parent = u->parent;
+    }
+
+    bool remove(int k) {
+        WAVLNode* z = root;
+        while(z && z->key != k) z = (k < z->key) ? z->left : z->right;
+        if(!z) return false;
+
+        if(z->left && z->right) {
+            WAVLNode* y = minimum(z->right);
+            z->key = y->key;
+            z->value = y->value;
+            z = y;
+        }
+        WAVLNode* x = z->left ? z->left : z->right;
+        WAVLNode* p = z->parent;
+        transplant(z, x);
+        delete z;
+        if(p) deleteFixup(x, p);
+        return true;
+    }
+
+    // x (possibly null) replaced a removed node under p. Demote until no
+    // 3-child is left, or finish with a single or double rotation.
+    void deleteFixup(WAVLNode* x, WAVLNode* p) {
+        if(!p->left && !p->right && p->rank == 1) {
+            p->rank = 0;
+            x = p;
+            p = p->parent;
+        }
+        while(p && p->rank - rank(x) == 3) {
+            bool xLeft = (x == p->left);
+            WAVLNode* y = xLeft ? p->right : p->left;
+            if(p->rank - y->rank == 2) {
+                p->rank--;
+            } else if(y->rank - rank(y->left) == 2 && y->rank - rank(y->right) == 2) {
+                y->rank--;
+                p->rank--;
+            } else {
+                WAVLNode* outer = xLeft ? y->right : y->left;
+                if(y->rank - rank(outer) == 1) {
+                    rotateUp(y);
+                    y->rank++;
+                    p->rank--;
+                    if(!p->left && !p->right) p->rank--;
+                } else {
+                    WAVLNode* w = xLeft ? y->left : y->right;
+                    rotateUp(w);
+                    rotateUp(w);
+                    w->rank += 2;
+                    y->rank--;
+                    p->rank -= 2;
+                }
+                break;
+            }
+            x = p;
+            p = p->parent;
+        }
+    }
+
+    void inorder(WAVLNode* n, vector<int>& out) {
+        if(!n) return;
+        inorder(n->left,out);
+        out.push_back(n->key);
+        inorder(n->right,out);
+    }
+
+    vector<int> inorderKeys() { vector<int> v; inorder(root,v); return v; }
+
+    void preorder(WAVLNode* n, vector<int>& out) {
+        if(!n) return;
+        out.push_back(n->key);
+        preorder(n->left,out);
+        preorder(n->right,out);
+    }
+
+    vector<int> preorderKeys() { vector<int> v; preorder(root,v); return v; }
+
+    void postorder(WAVLNode* n, vector<int>& out) {
+        if(!n) return;
+        postorder(n->left,out);
+        postorder(n->right,out);
+        out.push_back(n->key);
+    }
+
+    vector<int> postorderKeys() { vector<int> v; postorder(root,v); return v; }
+
+    int getHeight(WAVLNode* n) {
+        if(!n) return 0;
+        return 1 + max(getHeight(n->left), getHeight(n->right));
+    }
+
+    int getWidth(WAVLNode* n) {
+        if(!n) return 0;
+        int h = getHeight(n);
+        return (1 << h) - 1;
+    }
+
+    void fillMatrix(WAVLNode* n, vector<vector<string>>& matrix, int row, int left, int right) {
+        if(!n) return;
+        int mid = (left + right) / 2;
+        matrix[row][mid] = to_string(n->key) + "(" + to_string(n->rank) + ")";
+
+        if(n->left || n->right) {
+            int branchRow = row + 1;
+            if(n->left) {
+                int leftMid = (left + mid - 1) / 2;
+                matrix[branchRow][leftMid] = "/";
+                fillMatrix(n->left, matrix, row + 2, left, mid - 1);
+            }
+            if(n->right) {
+                int rightMid = (mid + 1 + right) / 2;
+                matrix[branchRow][rightMid] = "\\";
+                fillMatrix(n->right, matrix, row + 2, mid + 1, right);
+            }
+        }
+    }
+
+    void print2D() {
+        if(!root) { cout << "Tree is empty.\n"; return; }
+        int h = getHeight(root);
+        int w = getWidth(root);
+        int rows = h * 2 - 1;
+
+        vector<vector<string>> matrix(rows, vector<string>(w, " "));
+        fillMatrix(root, matrix, 0, 0, w - 1);
+
+        for(int i = 0; i < rows; i++) {
+            for(int j = 0; j < w; j++) {
+                cout << matrix[i][j];
+            }
+            cout << "\n";
+        }
+    }
+
+    // Nodes are written as "key/rank" since ranks cannot be recovered from
+    // the shape alone.
+    void saveToFile(const string &filename) {
+        ofstream ofs(filename);
+        savePre(root,ofs);
+    }
+    void savePre(WAVLNode* n, ostream &ofs) {
+        if(!n) { ofs<<"# "; return; }
+        ofs<<n->key<<":"<<n->value<<"/"<<n->rank<<" ";
+        savePre(n->left,ofs);
+        savePre(n->right,ofs);
+    }
+    void loadFromFile(const string &filename) {
+        ifstream ifs(filename);
+        loadFrom(ifs);
+    }
+    void loadFrom(istream& ifs) {
+        clear(root);
+        root = loadPre(ifs,nullptr);
+    }
+    WAVLNode* loadPre(istream &ifs,WAVLNode* parent) {
+        string tok; if(!(ifs>>tok)) return nullptr;
+        if(tok=="#") return nullptr;
+        int k, v;
+        size_t suffix = parseSnapshotToken(tok, k, v);
+        WAVLNode* n=new WAVLNode(k,v);
+        if(suffix < tok.size() && tok[suffix] == '/') n->rank = stoi(tok.substr(suffix + 1));
+        n->parent=parent;
+        n->left=loadPre(ifs,n);
+        n->right=loadPre(ifs,n);
+        return n;
+    }
+
+    void clearTree() {
+        clear(root);
+        root = nullptr;
+    }
+
+    void bulkLoad(const vector<pair<int,int>>& kv) {
+        clear(root);
+        root = buildSorted(kv, 0, (int)kv.size() - 1, nullptr);
+    }
+    WAVLNode* buildSorted(const vector<pair<int,int>>& kv, int lo, int hi, WAVLNode* parent) {
+        if(lo > hi) return nullptr;
+        int mid = lo + (hi - lo) / 2;
+        WAVLNode* n = new WAVLNode(kv[mid].first, kv[mid].second);
+        n->parent = parent;
+        n->left = buildSorted(kv, lo, mid - 1, n);
+        n->right = buildSorted(kv, mid + 1, hi, n);
+        n->rank = 1 + max(rank(n->left), rank(n->right));
+        return n;
+    }
+};
+
+// ---------------------
+// Splay
+// ---------------------
+// Self-adjusting tree: every search, insert and remove splays the touched
+// key to the root, so frequently used keys stay near the top. Splaying is
+// top-down (Sleator & Tarjan), one iterative pass without parent pointers.
+class SplayNode {
+public:
+    int key, value;
+    SplayNode *left, *right;
+    SplayNode(int k=0,int v=0): key(k), value(v), left(nullptr), right(nullptr) {}
+};
+
+class SplayTree {
+public:
+    SplayNode* root;
+    SplayTree(): root(nullptr) {}
+    ~SplayTree() { clear(root); }
+
+    // Sequential inserts leave a splay tree as a path of n nodes, so none of
+    // the whole-tree walks below may recurse. clear rotates left children up
+    // (as BST::clear does); the others keep an explicit stack.
+    void clear(SplayNode* n) {
+        while(n) {
+            if(n->left) {
+                SplayNode* l = n->left;
+                n->left = l->right;
+                l->right = n;
+                n = l;
+            } else {
+                SplayNode* r = n->right;
+                delete n;
+                n = r;
+            }
+        }
+    }
+
+    struct SearchResult {
+        bool found;
+        int depth;
+        SearchResult(): found(false), depth(0) {}
+        SearchResult(bool f, int d): found(f), depth(d) {}
+    };
+
+    // Brings k (or the last node on its search path) to the root of t.
+    // depth receives that node's depth before the splay. A non-zero side
+    // treats nodes equal to k as larger (side < 0) or smaller (side > 0),
+    // so the splay ends next to the start or end of a run of duplicates
+    // instead of at whichever one it meets first.
+    SplayNode* splay(SplayNode* t, int k, int& depth, int side = 0) {
+        depth = 0;
+        if(!t) return t;
+        auto cmp = [&](SplayNode* n) { return k < n->key ? -1 : k > n->key ? 1 : side; };
+        SplayNode halves;  // halves.right collects the left tree, halves.left the right tree
+        SplayNode *l = &halves, *r = &halves;
+        while(true) {
+            int c = cmp(t);
+            if(c < 0) {
+                if(!t->left) break;
+                if(cmp(t->left) < 0) {
+                    SplayNode* y = t->left;
+                    t->left = y->right;
+                    y->right = t;
+                    t = y;
+                    depth++;
+                    if(!t->left) break;
+                }
+                r->left = t; r = t;
+                t = t->left;
+                depth++;
+            } else if(c > 0) {
+                if(!t->right) break;
+                if(cmp(t->right) > 0) {
+                    SplayNode* y = t->right;
+                    t->right = y->left;
+                    y->left = t;
+                    t = y;
+                    depth++;
+                    if(!t->right) break;
+                }
+                l->right = t; l = t;
+                t = t->right;
+                depth++;
+            } else break;
+        }
+        l->right = t->left;
+        r->left = t->right;
+        t->left = halves.right;
+        t->right = halves.left;
+        return t;
+    }
+
+    // Brings the largest key of t to its root, leaving no right child.
+    SplayNode* splayMax(SplayNode* t) {
+        SplayNode side;
+        SplayNode* l = &side;
+        while(t->right) {
+            SplayNode* y = t->right;
+            t->right = y->left;
+            y->left = t;
+            t = y;
+            if(!t->right) break;
+            l->right = t; l = t;
+            t = t->right;
+        }
+        l->right = t->left;
+        t->left = side.right;
+        return t;
+    }
+
+    SearchResult search(int k) {
+        int depth;
+        root = splay(root, k, depth);
+        if(root && root->key == k) return SearchResult(true, depth);
+        return SearchResult(false, -1);
+    }
+
+    // Duplicates keep a fixed in-order position whatever the shape: a new
+    // key goes after its equals and remove takes the first of them. Searches
+    // only reshape the tree, so replaying the delta journal on a reloaded
+    // tree removes the same (key, value) entries as the live tree did.
+    void insert(int k, int v) {
+        SplayNode* n = new SplayNode(k,v);
+        int depth;
+        root = splay(root, k, depth, 1);
+        if(root) {
+            if(k < root->key) {
+                n->left = root->left;
+                n->right = root;
+                root->left = nullptr;
+            } else {
+                n->right = root->right;
+                n->left = root;
+                root->right = nullptr;
+            }
+        }
+        root = n;
+    }
+
+    bool remove(int k) {
+        int depth;
+        root = splay(root, k, depth, -1);
+        if(!root) return false;
+        if(root->key < k) {
+            // Landed just before the run: its first node is the minimum of
+            // the right subtree, which splaying there brings up with no
+            // left child.
+            if(!root->right) return false;
+            root->right = splay(root->right, k, depth, -1);
+            SplayNode* first = root->right;
+            if(first->key != k) return false;
+            root->right = first->right;
+            delete first;
+            return true;
+        }
+        if(root->key != k) return false;
+        SplayNode* old = root;
+        if(!root->left) root = root->right;
+        else {
+            root = splayMax(root->left);
+            root->right = old->right;
+        }
+        delete old;
+        return true;
+    }
+
+    void inorder(SplayNode* n, vector<int>& out) {
+        vector<SplayNode*> stack;
+        while(n || !stack.empty()) {
+            while(n) { stack.push_back(n); n = n->left; }
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            n = n->right;
+        }
+    }
+
+    vector<int> inorderKeys() { vector<int> v; inorder(root,v); return v; }
+
+    void preorder(SplayNode* n, vector<int>& out) {
+        vector<SplayNode*> stack;
+        if(n) stack.push_back(n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            if(n->right) stack.push_back(n->right);
+            if(n->left) stack.push_back(n->left);
+        }
+    }
+
+    vector<int> preorderKeys() { vector<int> v; preorder(root,v); return v; }
+
+    // Root-right-left order, reversed, is left-right-root.
+    void postorder(SplayNode* n, vector<int>& out) {
+        size_t start = out.size();
+        vector<SplayNode*> stack;
+        if(n) stack.push_back(n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            out.push_back(n->key);
+            if(n->left) stack.push_back(n->left);
+            if(n->right) stack.push_back(n->right);
+        }
+        reverse(out.begin() + start, out.end());
+    }
+
+    vector<int> postorderKeys() { vector<int> v; postorder(root,v); return v; }
+
+    int getHeight(SplayNode* n) {
+        int h = 0;
+        vector<pair<SplayNode*,int>> stack;
+        if(n) stack.push_back({n, 1});
+        while(!stack.empty()) {
+            pair<SplayNode*,int> top = stack.back(); stack.pop_back();
+            h = max(h, top.second);
+            if(top.first->left) stack.push_back({top.first->left, top.second + 1});
+            if(top.first->right) stack.push_back({top.first->right, top.second + 1});
+        }
+        return h;
+    }
+
+    int getWidth(SplayNode* n) {
+        if(!n) return 0;
+        int h = getHeight(n);
+        return (1 << h) - 1;
+    }
+
+    void fillMatrix(SplayNode* n, vector<vector<string>>& matrix, int row, int left, int right) {
+        if(!n) return;
+        int mid = (left + right) / 2;
+        matrix[row][mid] = to_string(n->key);
+
+        if(n->left || n->right) {
+            int branchRow = row + 1;
+            if(n->left) {
+                int leftMid = (left + mid - 1) / 2;
+                matrix[branchRow][leftMid] = "/";
+                fillMatrix(n->left, matrix, row + 2, left, mid - 1);
+            }
+            if(n->right) {
+                int rightMid = (mid + 1 + right) / 2;
+                matrix[branchRow][rightMid] = "\\";
+                fillMatrix(n->right, matrix, row + 2, mid + 1, right);
+            }
+        }
+    }
+
+    void print2D() {
+        if(!root) { cout << "Tree is empty.\n"; return; }
+        int h = getHeight(root);
+        if(h > MaxDrawHeight) { cout << "Tree height " << h << " is too tall to draw; use Traverse to list the keys.\n"; return; }
+        int w = getWidth(root);
+        int rows = h * 2 - 1;
+
+        vector<vector<string>> matrix(rows, vector<string>(w, " "));
+        fillMatrix(root, matrix, 0, 0, w - 1);
+
+        for(int i = 0; i < rows; i++) {
+            for(int j = 0; j < w; j++) {
+                cout << matrix[i][j];
+            }
+            cout << "\n";
+        }
+    }
+
+    void saveToFile(const string &filename) {
+        ofstream ofs(filename);
+        savePre(root,ofs);
+    }
+    void savePre(SplayNode* n, ostream &ofs) {
+        vector<SplayNode*> stack(1, n);
+        while(!stack.empty()) {
+            n = stack.back(); stack.pop_back();
+            if(!n) { ofs<<"# "; continue; }
+            ofs<<n->key<<":"<<n->value<<" ";
+            stack.push_back(n->right);
+            stack.push_back(n->left);
+        }
+    }
+    void loadFromFile(const string &filename) {
+        ifstream ifs(filename);
+        loadFrom(ifs);
+    }
+    void loadFrom(istream& ifs) {
+        clear(root);
+        root = loadPre(ifs);
+    }
+    // Keeps a stack of the child links still to be filled, in preorder.
+    SplayNode* loadPre(istream &ifs) {
+        SplayNode* top = nullptr;
+        vector<SplayNode**> slots(1, &top);
+        string tok;
+        while(!slots.empty() && ifs>>tok) {
+            SplayNode** slot = slots.back(); slots.pop_back();
+            if(tok=="#") continue;
+            int k, v;
+            parseSnapshotToken(tok, k, v);
+            SplayNode* n=new SplayNode(k,v);
+            *slot = n;
+            slots.push_back(&n->right);
+            slots.push_back(&n->left);
+        }
+        return top;
+    }
+
+    void clearTree() {
+        clear(root);
+        root = nullptr;
+    }
+
+    void bulkLoad(const vector<pair<int,int>>& kv) {
+        clear(root);
+        root = buildSorted(kv, 0, (int)kv.size() - 1);
+    }
+    SplayNode* buildSorted(const vector<pair<int,int>>& kv, int lo, int hi) {
+        if(lo > hi) return nullptr;
+        int mid = lo + (hi - lo) / 2;
+        SplayNode* n = new SplayNode(kv[mid].first, kv[mid].second);
+        n->left = buildSorted(kv, lo, mid - 1);
+        n->right = buildSorted(kv, mid + 1, hi);
+        return n;
+    }
+};
+
+// ---------------------
+// Dataset import/export
+// ---------------------
+// Key/value datasets are streamed through a fixed-size buffer. CSV rows are
+// "key,value" (value defaults to key; non-numeric lines such as a header
+// are skipped). Binary files (*.bin) hold little-endian int32 key/value
+// pairs and are copied straight out of the buffer.
+class ChunkReader {
+public:
+    FILE* f;
+    vector<char> buf;
+    size_t pos, len;
+    long long bytes;
+    long long skipped;  // CSV rows rejected by nextCsv
+
+    ChunkReader(const string& path, size_t chunk = 1 << 20)
+        : f(fopen(path.c_str(), "rb")), buf(chunk), pos(0), len(0), bytes(0), skipped(0) {}
+    ~ChunkReader() { if(f) fclose(f); }
+
+    // Keeps the unread tail and tops the buffer up from the file.
+    bool fill() {
+        if(!f) return false;
+        memmove(buf.data(), buf.data() + pos, len - pos);
+        len -= pos; pos = 0;
+        size_t got = fread(buf.data() + len, 1, buf.size() - len, f);
+        len += got; bytes += got;
+        return got > 0;
+    }
+
+    int next() {
+        if(pos == len && !fill()) return EOF;
+        return (unsigned char)buf[pos++];
+    }
+
+    // Parses an integer whose first character is c; returns the character
+    // that ended it. ok is cleared when there is no digit or the number does
+    // not fit in an int.
+    int parseInt(int c, int& out, bool& ok) {
+        bool neg = (c == '-');
+        if(neg) c = next();
+        unsigned long long x = 0;
+        bool digits = false;
+        while(c >= '0' && c <= '9') {
+            digits = true;
+            if(x <= (unsigned long long)INT_MAX + 1) x = x * 10 + (c - '0');
+            c = next();
+        }
+        if(!digits || x > (unsigned long long)INT_MAX + neg) ok = false;
+        else out = neg ? (int)-(long long)x : (int)x;
+        return c;
+    }
+
+    static bool endOfRow(int c) { return c == '\r' || c == '\n' || c == EOF; }
+
+    // Reads the next "key[,value]" row; a missing value defaults to the key.
+    // Rows without a number, with trailing text or with an out-of-range
+    // number (a header line, say) are skipped and counted.
+    bool nextCsv(int& k, int& v) {
+        while(true) {
+            int c = next();
+            while(c == ' ' || c == '\t' || c == '\r' || c == '\n') c = next();
+            if(c == EOF) return false;
+            bool ok = true;
+            c = parseInt(c, k, ok);
+            while(c == ' ' || c == '\t') c = next();
+            v = k;
+            if(ok && c == ',') {
+                c = next();
+                while(c == ' ' || c == '\t') c = next();
+                if(!endOfRow(c)) {
+                    c = parseInt(c, v, ok);
+                    while(c == ' ' || c == '\t') c = next();
+                }
+            }
+            if(!endOfRow(c)) ok = false;
+            while(c != '\n' && c != EOF) c = next();
+            if(ok) return true;
+            skipped++;
+        }
+    }
+
+    bool nextBinary(int& k, int& v) {
+        if(len - pos < 8 && (!fill() || len - pos < 8)) return false;
+        memcpy(&k, buf.data() + pos, 4);
+        memcpy(&v, buf.data() + pos + 4, 4);
+        pos += 8;
+        return true;
+    }
+};
+
+class ChunkWriter {
+public:
+    FILE* f;
+    vector<char> buf;
+    size_t len;
+    long long bytes;
+
+    ChunkWriter(const string& path, size_t chunk = 1 << 20)
+        : f(fopen(path.c_str(), "wb")), buf(chunk), len(0), bytes(0) {}
+    ~ChunkWriter() { flush(); if(f) fclose(f); }
+
+    void flush() {
+        if(f && len) fwrite(buf.data(), 1, len, f);
+        bytes += len;
+        len = 0;
+    }
+
+    void reserve(size_t n) { if(buf.size() - len < n) flush(); }
+
+    void putInt(int x) {
+        char tmp[12];
+        int i = 0;
+        unsigned u = x < 0 ? 0u - (unsigned)x : (unsigned)x;
+        do { tmp[i++] = char('0' + u % 10); u /= 10; } while(u);
+        if(x < 0) tmp[i++] = '-';
+        while(i) buf[len++] = tmp[--i];
+    }
+
+    void putCsv(int k, int v) {
+        reserve(24);
+        putInt(k); buf[len++] = ',';
+        putInt(v); buf[len++] = '\n';
+    }
+
+    void putBinary(int k, int v) {
+        reserve(8);
+        memcpy(buf.data() + len, &k, 4);
+        memcpy(buf.data() + len + 4, &v, 4);
+        len += 8;
+    }
+};
+
+struct TransferStats {
+    bool ok;
+    bool bulk;
+    long long records, bytes, skipped;
+    double seconds;
+    TransferStats(): ok(false), bulk(false), records(0), bytes(0), skipped(0), seconds(0) {}
+    double gbPerSec() const { return seconds > 0 ? bytes / seconds / 1e9 : 0; }
+};
+
+inline bool isBinaryPath(const string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+}
+
+// Trees with insertHint get the previous row's node as the hint, so a
+// mostly ascending file costs O(1) amortised per row; others insert from
+// the root.
+template<typename Tree>
+auto importRow(Tree& t, decltype(t.root)& hint, int k, int v, int) -> decltype(t.insertHint(hint, k, v), void()) {
+    hint = t.insertHint(hint, k, v);
+}
+template<typename Tree>
+void importRow(Tree& t, decltype(t.root)&, int k, int v, long) {
+    t.insert(k, v);
+}
+
+// Sorted input into an empty tree is buffered and bulk-built in O(n); as
+// soon as the input turns out unsorted (or the tree already has keys) the
+// rows fall back to ordinary (hinted) inserts.
+template<typename Tree>
+TransferStats importDataset(Tree& t, const string& path) {
+    TransferStats st;
+    auto start = chrono::steady_clock::now();
+    ChunkReader in(path);
+    if(!in.f) return st;
+    bool binary = isBinaryPath(path);
+    bool sorted = (t.root == nullptr);
+    vector<pair<int,int>> pending;
+    decltype(t.root) hint = nullptr;
+    int k, v;
+    while(binary ? in.nextBinary(k, v) : in.nextCsv(k, v)) {
+        st.records++;
+        if(sorted) {
+            if(pending.empty() || pending.back().first <= k) { pending.push_back({k, v}); continue; }
+            sorted = false;
+            for(const auto& kv : pending) importRow(t, hint, kv.first, kv.second, 0);
+            pending.clear();
+            pending.shrink_to_fit();
+        }
+        importRow(t, hint, k, v, 0);
+    }
+    if(sorted && !pending.empty()) { t.bulkLoad(pending); st.bulk = true; }
+    st.ok = true;
+    st.bytes = in.bytes;
+    st.skipped = in.skipped;
+    st.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return st;
+}
+
+// Streams in-order entries with an explicit stack instead of collecting
+// inorderKeys() first.
+template<typename Tree>
+TransferStats exportDataset(Tree& t, const string& path) {
+    TransferStats st;
+    auto start = chrono::steady_clock::now();
+    {
+        ChunkWriter out(path);
+        if(!out.f) return st;
+        bool binary = isBinaryPath(path);
+        vector<decltype(t.root)> stack;
+        auto n = t.root;
+        while(n || !stack.empty()) {
+            while(n) { stack.push_back(n); n = n->left; }
+            n = stack.back(); stack.pop_back();
+            if(binary) out.putBinary(n->key, n->value);
+            else out.putCsv(n->key, n->value);
+            st.records++;
+            n = n->right;
+        }
+        out.flush();
+        st.bytes = out.bytes;
+    }
+    st.ok = true;
+    st.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return st;
+}
+
+// ---------------------
+// Delta snapshots
+// ---------------------
+// Changes since the last full snapshot are appended to "<file>.delta" as
+// "+ key value" / "- key" records, so a save only writes what changed.
+// Loading replays the delta over the base file; once the delta holds at
+// least mergeEvery records and is larger than the base file, it is folded
+// back into a fresh full snapshot, which keeps merging O(1) amortized per
+// change.
+//
+// A merge writes the snapshot to a temp file, renames it over the base and
+// only then truncates the delta. Both files carry a generation ("@ n" after
+// the tree tokens in the base, first line of the delta), so a crash between
+// the rename and the truncate leaves a delta that load() recognises as
+// already merged instead of applying its inserts a second time.
+struct DeltaOp {
+    bool insert;
+    int key, value;
+};
+
+class DeltaJournal {
+public:
+    string base;
+    int entries;       // records already in the delta file
+    int mergeEvery;
+    int generation;
+    long long baseBytes, deltaBytes;
+    vector<DeltaOp> dirty;  // records not yet written
+
+    DeltaJournal(const string& b, int merge=256): base(b), entries(0), mergeEvery(merge), generation(0), baseBytes(0), deltaBytes(0) {}
+
+    string deltaPath() const { return base + ".delta"; }
+
+    static long long fileSize(const string& path) {
+        ifstream ifs(path, ios::binary | ios::ate);
+        return ifs ? (long long)ifs.tellg() : 0;
+    }
+
+    // Reads the "@ n" trailer; snapshots from before it existed are 0.
+    static int baseGeneration(const string& path) {
+        ifstream ifs(path, ios::binary | ios::ate);
+        if(!ifs) return 0;
+        long long size = ifs.tellg();
+        ifs.seekg(max(0LL, size - 32));
+        string tail((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+        size_t at = tail.rfind('@');
+        return at == string::npos ? 0 : atoi(tail.c_str() + at + 1);
+    }
+
+    void startDelta() {
+        ofstream ofs(deltaPath(), ios::trunc);
+        ofs<<"@ "<<generation<<"\n";
+        deltaBytes = ofs.tellp();
+    }
+
+    void record(bool insert, int k, int v) { dirty.push_back({insert, k, v}); }
+
+    void flush() {
+        if(dirty.empty()) return;
+        ofstream ofs(deltaPath(), ios::app);
+        if(deltaBytes == 0) ofs<<"@ "<<generation<<"\n";
+        for(const DeltaOp& op : dirty) {
+            if(op.insert) ofs<<"+ "<<op.key<<" "<<op.value<<"\n";
+            else ofs<<"- "<<op.key<<"\n";
+        }
+        deltaBytes = ofs.tellp();
+        entries += dirty.size();
+        dirty.clear();
+    }
+
+    template<typename Tree>
+    void save(Tree& t) {
+        flush();
+        if(entries >= mergeEvery && deltaBytes >= baseBytes) merge(t);
+    }
+
+    template<typename Tree>
+    void merge(Tree& t) {
+        string tmp = base + ".tmp";
+        t.saveToFile(tmp);
+        {
+            ofstream ofs(tmp, ios::app);
+            ofs<<"\n@ "<<generation + 1<<"\n";
+            if(!ofs) { cout<<"Could not write "<<tmp<<"\n"; return; }
+        }
+#ifdef _WIN32
+        std::remove(base.c_str());
+#endif
+        if(rename(tmp.c_str(), base.c_str()) != 0) { cout<<"Could not replace "<<base<<"\n"; return; }
+        generation++;
+        startDelta();
+        entries = 0;
+        dirty.clear();
+        baseBytes = fileSize(base);
+    }
+
+    // Merges only when the delta holds records, so exiting without changes
+    // does not rewrite every snapshot.
+    template<typename Tree>
+    void mergeIfChanged(Tree& t) {
+        if(entries > 0 || !dirty.empty()) merge(t);
+    }
+
+    template<typename Tree>
+    void load(Tree& t) {
+        t.loadFromFile(base);
+        dirty.clear();
+        entries = 0;
+        generation = baseGeneration(base);
+        bool stale = false;
+        {
+            ifstream ifs(deltaPath());
+            char op; int k, v;
+            int deltaGeneration = 0;    // no header: written before any merge
+            while(ifs >> op >> k) {
+                if(op == '@') { deltaGeneration = k; continue; }
+                if(deltaGeneration != generation) { stale = true; break; }
+                if(op == '+') { if(!(ifs >> v)) break; t.insert(k, v); }
+                else t.remove(k);
+                entries++;
+            }
+        }
+        if(stale) startDelta();
+        baseBytes = fileSize(base);
+        deltaBytes = fileSize(deltaPath());
+    }
+};
+
+// ---------------------
+// Trace recording
+// ---------------------
+// Opt-in binary log of every insert/remove/search. The file starts with
+// "TRC3" and the starting state: for each of the six trees, the length of
+// its snapshot text as a LEB128 varint, then the text itself. Each record
+// is one byte (op | tree << 2), then the nanoseconds since the previous
+// record and the zigzag-encoded key, both as varints, and for inserts the
+// zigzag-encoded value, so a typical record takes 4-10 bytes. "TRC2" files
+// have no insert values (the key is replayed as the value) and "TRC1"
+// files have no starting state either.
+enum TraceOpKind { TraceInsert = 0, TraceRemove = 1, TraceSearch = 2 };
+
+struct TraceOp {
+    int op, tree, key, value;
+    long long ns;  // offset from the first record
+};
+
+class TraceRecorder {
+public:
+    ChunkWriter out;
+    chrono::steady_clock::time_point last;
+
+    TraceRecorder(const string& path): out(path, 1 << 16), last(chrono::steady_clock::now()) {
+        out.reserve(4);
+        memcpy(out.buf.data(), "TRC3", 4);
+        out.len = 4;
+    }
+
+    bool ok() const { return out.f != nullptr; }
+
+    void putVarint(unsigned long long x) {
+        while(x >= 0x80) { out.buf[out.len++] = char(x | 0x80); x >>= 7; }
+        out.buf[out.len++] = char(x);
+    }
+
+    // Called once, before the first record.
+    void writeState(const vector<string>& snapshots) {
+        for(const string& text : snapshots) {
+            out.reserve(10);
+            putVarint(text.size());
+            for(size_t at = 0; at < text.size(); ) {
+                out.reserve(1);
+                size_t n = min(text.size() - at, out.buf.size() - out.len);
+                memcpy(out.buf.data() + out.len, text.data() + at, n);
+                out.len += n;
+                at += n;
+            }
+        }
+        last = chrono::steady_clock::now();
+    }
+
+    void putZigzag(int x) { putVarint(((unsigned)x << 1) ^ (unsigned)(x >> 31)); }
+
+    void record(int op, int tree, int key, int value) {
+        auto now = chrono::steady_clock::now();
+        long long ns = chrono::duration_cast<chrono::nanoseconds>(now - last).count();
+        last = now;
+        out.reserve(1 + 10 + 5 + 5);
+        out.buf[out.len++] = char(op | tree << 2);
+        putVarint(ns);
+        putZigzag(key);
+        if(op == TraceInsert) putZigzag(value);
+    }
+
+    void flush() { out.flush(); }
+};
+
+// Returns false if the file is missing, not a trace, truncated, or holds a
+// record with an unknown op or tree. state receives the six starting
+// snapshots, or stays empty for a "TRC1" trace.
+inline bool readTrace(const string& path, vector<TraceOp>& ops, vector<string>& state) {
+    ChunkReader in(path);
+    if(!in.f) return false;
+    char magic[4];
+    for(char& c : magic) { int b = in.next(); if(b == EOF) return false; c = char(b); }
+    if(memcmp(magic, "TRC", 3) != 0 || magic[3] < '1' || magic[3] > '3') return false;
+    bool withState = magic[3] >= '2', withValues = magic[3] >= '3';
+    auto varint = [&](unsigned long long& x) {
+        x = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            int b = in.next();
+            if(b == EOF) return false;
+            x |= (unsigned long long)(b & 0x7f) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return false;
+    };
+    auto zigzag = [&](int& x) {
+        unsigned long long zz;
+        if(!varint(zz)) return false;
+        x = (int)((unsigned)(zz >> 1) ^ (0u - (unsigned)(zz & 1)));
+        return true;
+    };
+    for(int t = 0; withState && t < 6; t++) {
+        unsigned long long size;
+        if(!varint(size)) return false;
+        string text;
+        text.reserve(min(size, 1ULL << 20));
+        for(unsigned long long i = 0; i < size; i++) {
+            int b = in.next();
+            if(b == EOF) return false;
+            text += char(b);
+        }
+        state.push_back(text);
+    }
+    long long t = -1;
+    int head;
+    while((head = in.next()) != EOF) {
+        TraceOp op;
+        op.op = head & 3;
+        op.tree = head >> 2;
+        if(op.op > TraceSearch || op.tree >= 6) return false;
+        unsigned long long ns;
+        if(!varint(ns) || !zigzag(op.key)) return false;
+        op.value = op.key;
+        if(withValues && op.op == TraceInsert && !zigzag(op.value)) return false;
+        t = (t < 0) ? 0 : t + (long long)ns;
+        op.ns = t;
+        ops.push_back(op);
+    }
+    return true;
+}
+
+// ---------------------
+// TreeManager
+// ---------------------
+
+class TreeManager {
+public:
+    BST bst;
+    AVL avl;
+    RBTree rb;
+    TDRBTree tdrb;
+    WAVLTree wavl;
+    SplayTree splay;
+
+    DeltaJournal bstLog{"bst.txt"};
+    DeltaJournal avlLog{"avl.txt"};
+    DeltaJournal rbLog{"rb.txt"};
+    DeltaJournal tdrbLog{"rbtd.txt"};
+    DeltaJournal wavlLog{"wavl.txt"};
+    DeltaJournal splayLog{"splay.txt"};
+    string dataDir = ".";
+
+    enum TreeType { BSTType, AVLType, RBType, TDRBType, WAVLType, SplayType };
+    TreeType currentTree = BSTType;
+
+    // Set by --record; every insert/remove/search is appended to it.
+    TraceRecorder* recorder = nullptr;
+
+    // Startup loads run in the background, one task per tree; operations on
+    // a tree wait for its own load only.
+    future<double> loading[6];
+    double loadMs[6] = {0, 0, 0, 0, 0, 0};
+    
+    void setTree(TreeType t) {
+        currentTree = t;
+    }
+
+    void insert(int key) {
+        waitLoaded(currentTree);
+        if(recorder) recorder->record(TraceInsert, currentTree, key, key);
+        switch (currentTree) {
+        case BSTType:
+            bst.insert(key, key);
+            bstLog.record(true, key, key);
+            bstLog.save(bst);
+            bst.print2D();
+            break;
+        case AVLType:
+            avl.insert(key, key);
+            avlLog.record(true, key, key);
+            avlLog.save(avl);
+            avl.print2D();
+            break;
+        case RBType:
+            rb.insert(key, key);
+            rbLog.record(true, key, key);
+            rbLog.save(rb);
+            rb.print2D();
+            break;
+        case TDRBType:
+            tdrb.insert(key, key);
+            tdrbLog.record(true, key, key);
+            tdrbLog.save(tdrb);
+            tdrb.print2D();
+            break;
+        case WAVLType:
+            wavl.insert(key, key);
+            wavlLog.record(true, key, key);
+            wavlLog.save(wavl);
+            wavl.print2D();
+            break;
+        case SplayType:
+            splay.insert(key, key);
+            splayLog.record(true, key, key);
+            splayLog.save(splay);
+            splay.print2D();
+            break;
+        }
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+    void remove(int key) {
+        waitLoaded(currentTree);
+        if(recorder) recorder->record(TraceRemove, currentTree, key, key);
+        switch (currentTree) {
+        case BSTType:
+            if(bst.remove(key)) bstLog.record(false, key, key);
+            bstLog.save(bst);
+            bst.print2D();
+            break;
+        case AVLType:
+            if(avl.remove(key)) avlLog.record(false, key, key);
+            avlLog.save(avl);
+            avl.print2D();
+            break;
+        case RBType:
+            if(rb.remove(key)) rbLog.record(false, key, key);
+            rbLog.save(rb);
+            rb.print2D();
+            break;
+        case TDRBType:
+            if(tdrb.remove(key)) tdrbLog.record(false, key, key);
+            tdrbLog.save(tdrb);
+            tdrb.print2D();
+            break;
+        case WAVLType:
+            if(wavl.remove(key)) wavlLog.record(false, key, key);
+            wavlLog.save(wavl);
+            wavl.print2D();
+            break;
+        case SplayType:
+            if(splay.remove(key)) splayLog.record(false, key, key);
+            splayLog.save(splay);
+            splay.print2D();
+            break;
+        }
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+    void search(int key) {
+        BST::SearchResult result;
+        AVL::SearchResult result2;
+        RBTree::SearchResult result3;
+        TDRBTree::SearchResult result4;
+        WAVLTree::SearchResult result5;
+        SplayTree::SearchResult result6;
+        
+        waitLoaded(currentTree);
+        if(recorder) recorder->record(TraceSearch, currentTree, key, key);
+        switch (currentTree) {
+        case BSTType:
+            result = bst.search(key);
+            break;
+        case AVLType:
+            result2 = avl.search(key);
+            result.found = result2.found;
+            result.depth = result2.depth;
+            break;
+        case RBType:
+            result3 = rb.search(key);
+            result.found = result3.found;
+            result.depth = result3.depth;
+            break;
+        case TDRBType:
+            result4 = tdrb.search(key);
+            result.found = result4.found;
+            result.depth = result4.depth;
+            break;
+        case WAVLType:
+            result5 = wavl.search(key);
+            result.found = result5.found;
+            result.depth = result5.depth;
+            break;
+        case SplayType:
+            result6 = splay.search(key);
+            result.found = result6.found;
+            result.depth = result6.depth;
+            break;
+        }
+        
+        if(result.found) {
+            cout << "Found at depth: " << result.depth << " (height from root: " << result.depth << ")\n";
+        } else {
+            cout << "Not found\n";
+        }
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+    void traverse() {
+        cout<<"\n====================\n";
+        cout<<"Select Traversal Type:\n";
+        cout<<"1. Preorder\n";
+        cout<<"2. Inorder\n";
         cout<<"3. Postorder\n";
         cout<<"4. All Three Orders\n";
         cout<<"Enter number: ";
         int choice;
         cin >> choice;
 
+        waitLoaded(currentTree);
         switch (currentTree) {
         case BSTType:
             if(choice==1) printVec(bst.preorderKeys(), "Preorder");
@@ -787,6 +2831,36 @@ public:
                 printVec(rb.postorderKeys(), "Postorder");
             }
             break;
+        case TDRBType:
+            if(choice==1) printVec(tdrb.preorderKeys(), "Preorder");
+            else if(choice==2) printVec(tdrb.inorderKeys(), "Inorder");
+            else if(choice==3) printVec(tdrb.postorderKeys(), "Postorder");
+            else if(choice==4) {
+                printVec(tdrb.preorderKeys(), "Preorder");
+                printVec(tdrb.inorderKeys(), "Inorder");
+                printVec(tdrb.postorderKeys(), "Postorder");
+            }
+            break;
+        case WAVLType:
+            if(choice==1) printVec(wavl.preorderKeys(), "Preorder");
+            else if(choice==2) printVec(wavl.inorderKeys(), "Inorder");
+            else if(choice==3) printVec(wavl.postorderKeys(), "Postorder");
+            else if(choice==4) {
+                printVec(wavl.preorderKeys(), "Preorder");
+                printVec(wavl.inorderKeys(), "Inorder");
+                printVec(wavl.postorderKeys(), "Postorder");
+            }
+            break;
+        case SplayType:
+            if(choice==1) printVec(splay.preorderKeys(), "Preorder");
+            else if(choice==2) printVec(splay.inorderKeys(), "Inorder");
+            else if(choice==3) printVec(splay.postorderKeys(), "Postorder");
+            else if(choice==4) {
+                printVec(splay.preorderKeys(), "Preorder");
+                printVec(splay.inorderKeys(), "Inorder");
+                printVec(splay.postorderKeys(), "Postorder");
+            }
+            break;
         }
         cout<<"Press any key to continue...";
         cin.ignore();
@@ -796,36 +2870,207 @@ public:
 
     void clearTree() {
         string filename;
+        waitLoaded(currentTree);
         switch (currentTree) {
         case BSTType:
             bst.clearTree();
-            bst.saveToFile("bst.txt");
+            bstLog.merge(bst);
             filename = "bst.txt";
             cout<<"BST cleared from memory and file.\n";
             break;
         case AVLType:
             avl.clearTree();
-            avl.saveToFile("avl.txt");
+            avlLog.merge(avl);
             filename = "avl.txt";
             cout<<"AVL Tree cleared from memory and file.\n";
             break;
         case RBType:
             rb.clearTree();
-            rb.saveToFile("rb.txt");
+            rbLog.merge(rb);
             filename = "rb.txt";
             cout<<"Red-Black Tree cleared from memory and file.\n";
             break;
+        case TDRBType:
+            tdrb.clearTree();
+            tdrbLog.merge(tdrb);
+            filename = "rbtd.txt";
+            cout<<"Top-down Red-Black Tree cleared from memory and file.\n";
+            break;
+        case WAVLType:
+            wavl.clearTree();
+            wavlLog.merge(wavl);
+            filename = "wavl.txt";
+            cout<<"WAVL Tree cleared from memory and file.\n";
+            break;
+        case SplayType:
+            splay.clearTree();
+            splayLog.merge(splay);
+            filename = "splay.txt";
+            cout<<"Splay Tree cleared from memory and file.\n";
+            break;
+        }
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+    void importFile(const string& path) {
+        TransferStats st;
+        waitLoaded(currentTree);
+        switch (currentTree) {
+        case BSTType: st = importDataset(bst, path); bstLog.merge(bst); break;
+        case AVLType: st = importDataset(avl, path); avlLog.merge(avl); break;
+        case RBType: st = importDataset(rb, path); rbLog.merge(rb); break;
+        case TDRBType: st = importDataset(tdrb, path); tdrbLog.merge(tdrb); break;
+        case WAVLType: st = importDataset(wavl, path); wavlLog.merge(wavl); break;
+        case SplayType: st = importDataset(splay, path); splayLog.merge(splay); break;
+        }
+        printTransfer(st, "Imported", path);
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+    void exportFile(const string& path) {
+        TransferStats st;
+        waitLoaded(currentTree);
+        switch (currentTree) {
+        case BSTType: st = exportDataset(bst, path); break;
+        case AVLType: st = exportDataset(avl, path); break;
+        case RBType: st = exportDataset(rb, path); break;
+        case TDRBType: st = exportDataset(tdrb, path); break;
+        case WAVLType: st = exportDataset(wavl, path); break;
+        case SplayType: st = exportDataset(splay, path); break;
+        }
+        printTransfer(st, "Exported", path);
+        cout<<"Press any key to continue...";
+        cin.ignore();
+        cin.get();
+        clearScreen();
+    }
+
+#ifdef TREE_AGGREGATES
+    void rangeQuery(int a, int b) {
+        Aggregate agg;
+        bool supported = true;
+        waitLoaded(currentTree);
+        switch (currentTree) {
+        case AVLType: agg = rangeAggregate(avl.root, a, b); break;
+        case RBType: agg = rangeAggregate(rb.root, a, b); break;
+        default: supported = false; break;
         }
+        if(!supported) cout << "Range aggregates are kept for AVL and Red-Black trees only.\n";
+        else if(!agg.count) cout << "No keys in [" << a << ", " << b << "]\n";
+        else cout << "Keys in [" << a << ", " << b << "]: count " << agg.count << ", sum " << agg.sum
+                  << ", min " << agg.mn << ", max " << agg.mx << "\n";
         cout<<"Press any key to continue...";
         cin.ignore();
         cin.get();
         clearScreen();
     }
+#endif
+
+    template<typename Tree>
+    static double timedLoad(DeltaJournal& log, Tree& t) {
+        auto start = chrono::steady_clock::now();
+        log.load(t);
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Set by --data-dir; keeps the tree files in dir (created if missing)
+    // instead of the working directory. Call before loadAll.
+    bool useDataDir(const string& dir) {
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        if(!filesystem::is_directory(dir)) return false;
+        for(DeltaJournal* log : {&bstLog, &avlLog, &rbLog, &tdrbLog, &wavlLog, &splayLog})
+            log->base = (filesystem::path(dir) / log->base).string();
+        dataDir = dir;
+        return true;
+    }
 
     void loadAll() {
-        bst.loadFromFile("bst.txt");
-        avl.loadFromFile("avl.txt");
-        rb.loadFromFile("rb.txt");
+        loading[BSTType] = async(launch::async, [this] { return timedLoad(bstLog, bst); });
+        loading[AVLType] = async(launch::async, [this] { return timedLoad(avlLog, avl); });
+        loading[RBType] = async(launch::async, [this] { return timedLoad(rbLog, rb); });
+        loading[TDRBType] = async(launch::async, [this] { return timedLoad(tdrbLog, tdrb); });
+        loading[WAVLType] = async(launch::async, [this] { return timedLoad(wavlLog, wavl); });
+        loading[SplayType] = async(launch::async, [this] { return timedLoad(splayLog, splay); });
+    }
+
+    void waitLoaded(TreeType t) {
+        if(loading[t].valid()) loadMs[t] = loading[t].get();
+    }
+
+    string loadStatus(TreeType t) {
+        if(loading[t].valid() && loading[t].wait_for(chrono::seconds(0)) != future_status::ready)
+            return "loading...";
+        waitLoaded(t);
+        ostringstream os;
+        os << "loaded in " << fixed << setprecision(1) << loadMs[t] << " ms";
+        return os.str();
+    }
+
+    // Non-interactive entry point used by the socket server: runs one op on
+    // tree t without printing. Returns the search depth (-1 if not found),
+    // or for insert/remove 0 on success and -1 if the key was missing.
+    // Deltas are only queued; call saveDirty() once per batch.
+    int apply(TreeType t, int op, int key, int value) {
+        waitLoaded(t);
+        if(recorder) recorder->record(op, t, key, value);
+        switch (t) {
+        case BSTType: return applyTo(bst, bstLog, op, key, value);
+        case AVLType: return applyTo(avl, avlLog, op, key, value);
+        case RBType: return applyTo(rb, rbLog, op, key, value);
+        case TDRBType: return applyTo(tdrb, tdrbLog, op, key, value);
+        case WAVLType: return applyTo(wavl, wavlLog, op, key, value);
+        case SplayType: return applyTo(splay, splayLog, op, key, value);
+        }
+        return -1;
+    }
+
+    void saveDirty() {
+        if(!bstLog.dirty.empty()) bstLog.save(bst);
+        if(!avlLog.dirty.empty()) avlLog.save(avl);
+        if(!rbLog.dirty.empty()) rbLog.save(rb);
+        if(!tdrbLog.dirty.empty()) tdrbLog.save(tdrb);
+        if(!wavlLog.dirty.empty()) wavlLog.save(wavl);
+        if(!splayLog.dirty.empty()) splayLog.save(splay);
+    }
+
+    // Waits for every tree to load and writes their snapshots at the start
+    // of the trace, so a replay begins from the same trees.
+    void startRecording(TraceRecorder* r) {
+        for(int t = 0; t < 6; t++) waitLoaded((TreeType)t);
+        vector<string> state(6);
+        ostringstream os;
+        os.str(""); bst.savePre(bst.root, os); state[BSTType] = os.str();
+        os.str(""); avl.savePre(avl.root, os); state[AVLType] = os.str();
+        os.str(""); rb.savePre(rb.root, os); state[RBType] = os.str();
+        os.str(""); tdrb.savePre(tdrb.root, os); state[TDRBType] = os.str();
+        os.str(""); wavl.savePre(wavl.root, os); state[WAVLType] = os.str();
+        os.str(""); splay.savePre(splay.root, os); state[SplayType] = os.str();
+        r->writeState(state);
+        recorder = r;
+    }
+
+    // Folds pending deltas into full snapshots, e.g. on exit.
+    void saveAll() {
+        if(recorder) recorder->flush();
+        waitLoaded(BSTType);
+        waitLoaded(AVLType);
+        waitLoaded(RBType);
+        waitLoaded(TDRBType);
+        waitLoaded(WAVLType);
+        waitLoaded(SplayType);
+        bstLog.mergeIfChanged(bst);
+        avlLog.mergeIfChanged(avl);
+        rbLog.mergeIfChanged(rb);
+        tdrbLog.mergeIfChanged(tdrb);
+        wavlLog.mergeIfChanged(wavl);
+        splayLog.mergeIfChanged(splay);
     }
 
     void clearScreen() {
@@ -837,6 +3082,29 @@ public:
     }
 
 private:
+    template<typename Tree>
+    static int applyTo(Tree& t, DeltaJournal& log, int op, int key, int value) {
+        if(op == TraceInsert) {
+            t.insert(key, value);
+            log.record(true, key, value);
+            return 0;
+        }
+        if(op == TraceRemove) {
+            if(!t.remove(key)) return -1;
+            log.record(false, key, key);
+            return 0;
+        }
+        return t.search(key).depth;
+    }
+
+    void printTransfer(const TransferStats& st, const string& verb, const string& path) {
+        if(!st.ok) { cout << "Could not open " << path << "\n"; return; }
+        cout << verb << " " << st.records << " records (" << st.bytes << " bytes) in "
+             << fixed << setprecision(3) << st.seconds * 1000 << " ms, "
+             << st.gbPerSec() << " GB/s" << (st.bulk ? " [bulk build]" : "") << "\n";
+        if(st.skipped) cout << "Skipped " << st.skipped << " malformed or out-of-range rows\n";
+    }
+
     void printVec(const vector<int>& v, const string& label) {
         cout << label << ": ";
         for (int x : v) cout << x << " ";
@@ -844,31 +3112,901 @@ private:
     }
 };
 
+// ---------------------
+// Benchmarks
+// ---------------------
+// Run with "--bench <name>"; each benchmark prints its own table and does
+// not touch the tree files.
+struct Stopwatch {
+    chrono::steady_clock::time_point start;
+    Stopwatch(): start(chrono::steady_clock::now()) {}
+    double ms() const { return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(); }
+};
+
+vector<int> shuffledKeys(int n, unsigned seed) {
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = i;
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+// Inserts, searches and removes every key, printing ns/op for each phase.
+template<typename Tree>
+void benchPhases(const string& label, const vector<int>& keys) {
+    Tree t;
+    Stopwatch ins;
+    for(int k : keys) t.insert(k, k);
+    double insMs = ins.ms();
+    int height = t.getHeight(t.root);
+    Stopwatch sea;
+    long long found = 0;
+    for(int k : keys) found += t.search(k).found;
+    double seaMs = sea.ms();
+    Stopwatch rem;
+    for(int k : keys) t.remove(k);
+    double remMs = rem.ms();
+    double per = 1e6 / keys.size();
+    cout << left << setw(22) << label << right << fixed << setprecision(1)
+         << setw(10) << insMs * per << setw(10) << seaMs * per << setw(10) << remMs * per
+         << setw(8) << height << (found == (long long)keys.size() ? "" : "  (search mismatch)") << "\n";
+}
+
+void benchHeader(const string& title) {
+    cout << "\n" << title << "\n";
+    cout << left << setw(22) << "tree" << right << setw(10) << "ins ns" << setw(10) << "find ns"
+         << setw(10) << "del ns" << setw(8) << "height" << "\n";
+}
+
+void benchTopDownRB(int n) {
+    cout << "Node size: RBNode " << sizeof(RBNode) << " bytes, TDRBNode " << sizeof(TDRBNode) << " bytes\n";
+    vector<int> random = shuffledKeys(n, 42);
+    vector<int> sorted(n);
+    for(int i = 0; i < n; i++) sorted[i] = i;
+
+    benchHeader("Random keys, n = " + to_string(n));
+    benchPhases<RBTree>("RB bottom-up", random);
+    benchPhases<TDRBTree>("RB top-down", random);
+    benchHeader("Sorted keys, n = " + to_string(n));
+    benchPhases<RBTree>("RB bottom-up", sorted);
+    benchPhases<TDRBTree>("RB top-down", sorted);
+}
+
+template<typename Tree>
+int insertOnlyHeight(const vector<int>& keys) {
+    Tree t;
+    for(int k : keys) t.insert(k, k);
+    return t.getHeight(t.root);
+}
+
+double percentile(vector<double>& v, double q) {
+    if(v.empty()) return 0;
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, (size_t)(q * v.size()))];
+}
+
+// Replays a mixed insert/delete trace over a prefilled tree and prints the
+// latency distribution of each kind of operation.
+template<typename Tree>
+void benchMixedLatency(const string& label, const vector<int>& prefill, const vector<pair<bool,int>>& trace) {
+    Tree t;
+    for(int k : prefill) t.insert(k, k);
+    vector<double> insNs, delNs;
+    long long delRotations = 0;
+    for(const auto& op : trace) {
+        long long rot = t.rotations;
+        auto start = chrono::steady_clock::now();
+        if(op.first) t.insert(op.second, op.second);
+        else t.remove(op.second);
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        if(op.first) insNs.push_back(ns);
+        else { delNs.push_back(ns); delRotations += t.rotations - rot; }
+    }
+    double rotPerDel = delNs.empty() ? 0 : (double)delRotations / delNs.size();
+    cout << left << setw(10) << label << right << fixed << setprecision(0)
+         << setw(10) << percentile(insNs, 0.5) << setw(10) << percentile(insNs, 0.99)
+         << setw(10) << percentile(delNs, 0.5) << setw(10) << percentile(delNs, 0.99)
+         << setw(10) << percentile(delNs, 0.999) << setw(12) << percentile(delNs, 1.0)
+         << setprecision(3) << setw(10) << rotPerDel << "\n";
+}
+
+void benchWAVL(int n, int ops) {
+    vector<int> random = shuffledKeys(n, 7);
+    vector<int> sorted(n);
+    for(int i = 0; i < n; i++) sorted[i] = i;
+    cout << "Height after " << n << " inserts (random / sorted)\n";
+    cout << "  AVL   " << insertOnlyHeight<AVL>(random) << " / " << insertOnlyHeight<AVL>(sorted) << "\n";
+    cout << "  WAVL  " << insertOnlyHeight<WAVLTree>(random) << " / " << insertOnlyHeight<WAVLTree>(sorted) << "\n";
+    cout << "  RB    " << insertOnlyHeight<RBTree>(random) << " / " << insertOnlyHeight<RBTree>(sorted) << "\n";
+
+    // Half of each trace deletes a random live key, half inserts a fresh one.
+    mt19937 rng(11);
+    vector<int> live(random.begin(), random.end());
+    vector<pair<bool,int>> trace;
+    for(int i = 0; i < ops; i++) {
+        if(rng() % 2 && !live.empty()) {
+            size_t at = rng() % live.size();
+            trace.push_back({false, live[at]});
+            live[at] = live.back();
+            live.pop_back();
+        } else {
+            int k = (int)(rng() % (unsigned)(4 * n));
+            trace.push_back({true, k});
+            live.push_back(k);
+        }
+    }
+    cout << "\nMixed insert/delete trace: " << ops << " ops over " << n << " keys (ns)\n";
+    cout << left << setw(10) << "tree" << right << setw(10) << "ins p50" << setw(10) << "ins p99"
+         << setw(10) << "del p50" << setw(10) << "del p99" << setw(10) << "del p99.9"
+         << setw(12) << "del max" << setw(10) << "rot/del" << "\n";
+    benchMixedLatency<AVL>("AVL", random, trace);
+    benchMixedLatency<RBTree>("RB", random, trace);
+    benchMixedLatency<WAVLTree>("WAVL", random, trace);
+}
+
+// Draws ranks 0..n-1 with probability proportional to 1/(rank+1)^s.
+class ZipfSampler {
+public:
+    vector<double> cdf;
+    ZipfSampler(int n, double s): cdf(n) {
+        double sum = 0;
+        for(int i = 0; i < n; i++) { sum += 1.0 / pow(i + 1.0, s); cdf[i] = sum; }
+        for(double& c : cdf) c /= sum;
+    }
+    int operator()(mt19937& rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        return min((int)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), (int)cdf.size() - 1);
+    }
+};
+
+template<typename Tree>
+void benchSearchTrace(const string& label, Tree& t, const vector<int>& trace) {
+    long long depthSum = 0;
+    Stopwatch sw;
+    for(int k : trace) depthSum += t.search(k).depth;
+    double ms = sw.ms();
+    cout << left << setw(10) << label << right << fixed << setprecision(2)
+         << setw(12) << (double)depthSum / trace.size()
+         << setw(12) << trace.size() / ms / 1000 << "\n";
+}
+
+// Balanced trees are bulk-built from the sorted keys (their best shape);
+// the splay tree is built by inserting the keys in random order.
+void benchSplay(int n, int queries) {
+    vector<int> keys = shuffledKeys(n, 3);
+    vector<pair<int,int>> sorted;
+    for(int i = 0; i < n; i++) sorted.push_back({i, i});
+    AVL avl; avl.bulkLoad(sorted);
+    RBTree rb; rb.bulkLoad(sorted);
+    WAVLTree wavl; wavl.bulkLoad(sorted);
+
+    mt19937 rng(5);
+    struct Trace { string name; vector<int> keys; };
+    vector<Trace> traces;
+    traces.push_back({"uniform", {}});
+    for(int i = 0; i < queries; i++) traces.back().keys.push_back(keys[rng() % n]);
+    for(double s : {0.8, 1.0, 1.2}) {
+        ZipfSampler zipf(n, s);
+        ostringstream name;
+        name << "zipf s=" << s;
+        traces.push_back({name.str(), {}});
+        for(int i = 0; i < queries; i++) traces.back().keys.push_back(keys[zipf(rng)]);
+    }
+
+    for(const Trace& tr : traces) {
+        SplayTree splay;
+        for(int k : keys) splay.insert(k, k);
+        cout << "\n" << tr.name << ": " << queries << " searches over " << n << " keys\n";
+        cout << left << setw(10) << "tree" << right << setw(12) << "avg depth" << setw(12) << "Mops/s" << "\n";
+        benchSearchTrace("AVL", avl, tr.keys);
+        benchSearchTrace("RB", rb, tr.keys);
+        benchSearchTrace("WAVL", wavl, tr.keys);
+        benchSearchTrace("Splay", splay, tr.keys);
+    }
+}
+
+// Ascending keys where each key is moved by up to window places.
+vector<int> jitteredKeys(int n, int window, unsigned seed) {
+    mt19937 rng(seed);
+    vector<pair<int,int>> order(n);
+    for(int i = 0; i < n; i++) order[i] = {i + (int)(rng() % window), i};
+    sort(order.begin(), order.end());
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = order[i].second;
+    return keys;
+}
+
+// Inserts the stream from the root into one tree and with the previous
+// node as the hint into another, then looks every key up both ways.
+template<typename Tree>
+void benchFingerTree(const string& label, const vector<int>& keys) {
+    Tree plain, hinted;
+    Stopwatch ins;
+    for(int k : keys) plain.insert(k, k);
+    double insMs = ins.ms();
+    Stopwatch hins;
+    decltype(hinted.root) hint = nullptr;
+    for(int k : keys) hint = hinted.insertHint(hint, k, k);
+    double hinsMs = hins.ms();
+    long long found = 0;
+    Stopwatch sea;
+    for(int k : keys) found += plain.search(k).found;
+    double seaMs = sea.ms();
+    Stopwatch hsea;
+    hint = nullptr;
+    for(int k : keys) {
+        auto n = hinted.searchHint(hint, k);
+        if(n) { found++; hint = n; }
+    }
+    double hseaMs = hsea.ms();
+    double per = 1e6 / keys.size();
+    cout << left << setw(10) << label << right << setw(8) << keys.size() << fixed << setprecision(1)
+         << setw(11) << insMs * per << setw(11) << hinsMs * per << setw(11) << seaMs * per
+         << setw(11) << hseaMs * per << setw(8) << hinted.getHeight(hinted.root)
+         << (found == 2 * (long long)keys.size() ? "" : "  (search mismatch)") << "\n";
+}
+
+// The plain BST degenerates into a list on these streams, so it runs with
+// fewer keys than the balanced trees.
+void benchFinger(int n, int bstN) {
+    struct Stream { string name; vector<int> keys, bstKeys; };
+    vector<Stream> streams(3);
+    streams[0].name = "ascending";
+    for(int i = 0; i < n; i++) streams[0].keys.push_back(i);
+    for(int i = 0; i < bstN; i++) streams[0].bstKeys.push_back(i);
+    for(int s = 1; s < 3; s++) {
+        int window = s == 1 ? 4 : 16;
+        streams[s].name = "jittered (window " + to_string(window) + ")";
+        streams[s].keys = jitteredKeys(n, window, 7);
+        streams[s].bstKeys = jitteredKeys(bstN, window, 7);
+    }
+
+    for(const Stream& st : streams) {
+        cout << "\n" << st.name << ", ns/op\n";
+        cout << left << setw(10) << "tree" << right << setw(8) << "n" << setw(11) << "root ins"
+             << setw(11) << "hint ins" << setw(11) << "root find" << setw(11) << "hint find" << setw(8) << "height" << "\n";
+        benchFingerTree<BST>("BST", st.bstKeys);
+        benchFingerTree<AVL>("AVL", st.keys);
+        benchFingerTree<RBTree>("RB", st.keys);
+    }
+}
+
+struct RebuildingBST : BST {
+    RebuildingBST() { rebuild = true; }
+};
+
+// Inputs that turn a plain BST into a list: ascending, descending, and
+// alternating lowest/highest remaining key (a zigzag path).
+void benchDegenerate(int n, int bstN) {
+    auto adversarial = [](int count, int kind) {
+        vector<int> keys;
+        for(int i = 0; i < count; i++) {
+            if(kind == 0) keys.push_back(i);
+            else if(kind == 1) keys.push_back(count - 1 - i);
+            else keys.push_back(i % 2 ? count - 1 - i / 2 : i / 2);
+        }
+        return keys;
+    };
+    const char* names[] = {"Sorted", "Reverse sorted", "Zigzag"};
+    for(int kind = 0; kind < 3; kind++) {
+        vector<int> keys = adversarial(n, kind);
+        vector<int> small = adversarial(bstN, kind);
+        benchHeader(string(names[kind]) + " keys, n = " + to_string(n) + " (plain BST: " + to_string(bstN) + ")");
+        benchPhases<BST>("BST", small);
+        benchPhases<RebuildingBST>("BST rebuild", keys);
+        benchPhases<AVL>("AVL", keys);
+        benchPhases<RBTree>("RB", keys);
+    }
+}
+
+int runBenchmark(const string& name) {
+    if(name == "rb") benchTopDownRB(1000000);
+    else if(name == "wavl") benchWAVL(20000, 50000);
+    else if(name == "splay") benchSplay(1000000, 2000000);
+    else if(name == "finger") benchFinger(1000000, 20000);
+    else if(name == "degenerate") benchDegenerate(1000000, 20000);
+    else {
+        cout << "Unknown benchmark: " << name << "\n";
+        cout << "Available: rb, wavl, splay, finger, degenerate\n";
+        return 1;
+    }
+    return 0;
+}
+
+// ---------------------
+// Self-checks
+// ---------------------
+// Run with "--check"; prints one line per check and exits non-zero if any
+// failed. Scratch files are created in the current directory and removed.
+int checkFailures = 0;
+
+void checkResult(const string& name, bool ok) {
+    cout << left << setw(36) << name << (ok ? "ok" : "FAILED") << "\n";
+    if(!ok) checkFailures++;
+}
+
+string readWhole(const string& path) {
+    ifstream ifs(path, ios::binary);
+    stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+// Imports rows the way the menu does (import, then merge), journals one
+// more insert (4,400) and loads the snapshot plus delta back into t, which
+// must be empty. The scratch files are removed again.
+template<typename Tree>
+void reloadImported(Tree& t, const string& base, const string& rows) {
+    string csv = base + ".csv";
+    { ofstream ofs(csv); ofs << rows; }
+    {
+        Tree live;
+        DeltaJournal log(base);
+        log.load(live);
+        importDataset(live, csv);
+        log.merge(live);
+        live.insert(4, 400);
+        log.record(true, 4, 400);
+        log.save(live);
+    }
+    DeltaJournal log(base);
+    log.load(t);
+    for(const string& f : {csv, base, log.deltaPath()}) std::remove(f.c_str());
+}
+
+template<typename Tree>
+bool checkRoundTrip(const string& base) {
+    string out = base + ".out.csv";
+    Tree t;
+    reloadImported(t, base, "3,300\n1,100\n2,-200\n");
+    exportDataset(t, out);
+    bool ok = readWhole(out) == "1,100\n2,-200\n3,300\n4,400\n";
+    std::remove(out.c_str());
+    return ok;
+}
+
+bool checkLegacySnapshot() {
+    string base = "selfcheck_legacy.txt", out = base + ".out.csv";
+    { ofstream ofs(base); ofs << "5 3 # # 8 # # "; }
+    AVL t;
+    t.loadFromFile(base);
+    exportDataset(t, out);
+    bool ok = readWhole(out) == "3,3\n5,5\n8,8\n";
+    std::remove(base.c_str());
+    std::remove(out.c_str());
+    return ok;
+}
+
+// A mostly sorted import leaves the plain BST as one long path; saving and
+// reloading it must not recurse down that path.
+bool checkDeepBST() {
+    const int n = 300000;
+    string base = "selfcheck_deep_bst.txt";
+    BST t;
+    BSTNode* hint = nullptr;
+    for(int k = 0; k < n; k++) hint = t.insertHint(hint, k, -k);
+    t.saveToFile(base);
+    BST back;
+    back.loadFromFile(base);
+    vector<int> keys = back.inorderKeys();
+    bool ok = (int)keys.size() == n && back.getHeight(back.root) == n && back.root->height == n;
+    for(int k = 0; ok && k < n; k++) ok = keys[k] == k;
+    ok = ok && back.searchHint(nullptr, n - 1) && back.searchHint(nullptr, n - 1)->value == 1 - n;
+    // --bst-rebuild must turn the same file back into a balanced tree.
+    BST rebuilt;
+    rebuilt.rebuild = true;
+    rebuilt.loadFromFile(base);
+    ok = ok && rebuilt.getHeight(rebuilt.root) == 19 && rebuilt.inorderKeys() == keys;
+    std::remove(base.c_str());
+    return ok;
+}
+
+// Searches reshape a splay tree without being journalled, so a journalled
+// "- key" among duplicates must still remove the same entry after a reload.
+bool checkSplayDuplicates() {
+    string base = "selfcheck_splay_dup.txt", a = base + ".live.csv", b = base + ".back.csv";
+    SplayTree live;
+    DeltaJournal log(base);
+    log.load(live);
+    for(int v : {10, 20, 30}) { live.insert(1, v); log.record(true, 1, v); }
+    live.insert(0, 0); log.record(true, 0, 0);
+    live.insert(2, 2); log.record(true, 2, 2);
+    log.merge(live);
+    live.search(0);
+    live.search(2);
+    if(live.remove(1)) log.record(false, 1, 1);
+    log.save(live);
+    SplayTree back;
+    DeltaJournal log2(base);
+    log2.load(back);
+    exportDataset(live, a);
+    exportDataset(back, b);
+    bool ok = readWhole(a) == "0,0\n1,20\n1,30\n2,2\n" && readWhole(b) == readWhole(a);
+    for(const string& f : {a, b, base, log.deltaPath()}) std::remove(f.c_str());
+    return ok;
+}
+
+// remove() must say whether the key was there: the server replies and
+// journals on it.
+template<typename Tree>
+bool checkRemoveReportsMissing() {
+    Tree t;
+    for(int k : {5, 3, 8, 1, 4}) t.insert(k, k);
+    return !t.remove(7) && t.remove(3) && !t.remove(3) && t.search(4).found && !t.search(3).found;
+}
+
+#ifdef TREE_AGGREGATES
+// Range sums must come from the stored values, so reload an imported tree
+// (snapshot plus one journalled insert) and query it.
+template<typename Tree>
+bool checkRangeAfterReload(const string& base) {
+    Tree t;
+    reloadImported(t, base, "3,300\n1,100\n2,-200\n5,500\n");
+    Aggregate a = rangeAggregate(t.root, 1, 3), b = rangeAggregate(t.root, 2, 4);
+    return a.count == 3 && a.sum == 200 && a.mn == -200 && a.mx == 300
+        && b.count == 3 && b.sum == 500 && b.mn == -200 && b.mx == 400;
+}
+#endif
+
+int runChecks() {
+    checkResult("snapshot round trip: bst", checkRoundTrip<BST>("selfcheck_bst.txt"));
+    checkResult("snapshot round trip: avl", checkRoundTrip<AVL>("selfcheck_avl.txt"));
+    checkResult("snapshot round trip: rb", checkRoundTrip<RBTree>("selfcheck_rb.txt"));
+    checkResult("snapshot round trip: rbtd", checkRoundTrip<TDRBTree>("selfcheck_rbtd.txt"));
+    checkResult("snapshot round trip: wavl", checkRoundTrip<WAVLTree>("selfcheck_wavl.txt"));
+    checkResult("snapshot round trip: splay", checkRoundTrip<SplayTree>("selfcheck_splay.txt"));
+    checkResult("key-only snapshot still loads", checkLegacySnapshot());
+    checkResult("deep bst save, reload and rebuild", checkDeepBST());
+    checkResult("splay duplicates survive reload", checkSplayDuplicates());
+    checkResult("remove of missing key: bst", checkRemoveReportsMissing<BST>());
+    checkResult("remove of missing key: avl", checkRemoveReportsMissing<AVL>());
+    checkResult("remove of missing key: rb", checkRemoveReportsMissing<RBTree>());
+    checkResult("remove of missing key: rbtd", checkRemoveReportsMissing<TDRBTree>());
+    checkResult("remove of missing key: wavl", checkRemoveReportsMissing<WAVLTree>());
+    checkResult("remove of missing key: splay", checkRemoveReportsMissing<SplayTree>());
+#ifdef TREE_AGGREGATES
+    checkResult("range sums after reload: avl", checkRangeAfterReload<AVL>("selfcheck_range_avl.txt"));
+    checkResult("range sums after reload: rb", checkRangeAfterReload<RBTree>("selfcheck_range_rb.txt"));
+#endif
+    return checkFailures ? 1 : 0;
+}
+
+// ---------------------
+// Trace replay
+// ---------------------
+// "--replay <trace> [tree] [--timed]" re-executes a recorded trace with
+// every tree type in turn (or only the one named). Each recorded tree gets
+// its own tree of the replayed type, loaded with the contents it had when
+// recording started, and receives the ops that were recorded on it. When
+// the types match, the snapshot is loaded as is (same shape, colours and
+// ranks); otherwise its key/value pairs are bulk-built. --timed keeps the
+// recorded gaps between operations; otherwise they run back to back.
+const char* const treeNames[] = {"bst", "avl", "rb", "rbtd", "wavl", "splay"};
+const char* const traceOpNames[] = {"insert", "remove", "search"};
+
+template<typename Tree>
+void loadReplayState(Tree& t, const string& text, bool sameType) {
+    istringstream is(text);
+    if(sameType) { t.loadFrom(is); return; }
+    vector<pair<int,int>> kv;
+    string tok;
+    while(is >> tok) {
+        if(tok == "#" || tok[0] == '@') continue;
+        int k, v;
+        parseSnapshotToken(tok, k, v);
+        kv.push_back({k, v});
+    }
+    sort(kv.begin(), kv.end());
+    t.bulkLoad(kv);
+}
+
+template<typename Tree>
+void replayOn(int type, const vector<TraceOp>& ops, const vector<string>& state, bool timed) {
+    Tree trees[6];
+    size_t loaded = 0;
+    for(int i = 0; i < (int)state.size() && i < 6; i++) {
+        if(state[i].empty()) continue;
+        loadReplayState(trees[i], state[i], i == type);
+        loaded += state[i].size();
+    }
+    vector<double> lat[3];
+    auto start = chrono::steady_clock::now();
+    for(const TraceOp& op : ops) {
+        Tree& t = trees[op.tree];
+        if(timed) this_thread::sleep_until(start + chrono::nanoseconds(op.ns));
+        auto before = chrono::steady_clock::now();
+        if(op.op == TraceInsert) t.insert(op.key, op.value);
+        else if(op.op == TraceRemove) t.remove(op.key);
+        else t.search(op.key);
+        lat[op.op].push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - before).count());
+    }
+    double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "\n" << treeNames[type] << ": " << ops.size() << " ops in " << fixed << setprecision(2) << totalMs << " ms";
+    if(state.empty()) cout << " (trace has no starting state, trees start empty)";
+    else cout << " (starting state: " << loaded << " bytes of snapshots)";
+    cout << "\n";
+    cout << left << setw(8) << "op" << right << setw(10) << "count" << setw(10) << "p50 ns" << setw(10) << "p90 ns"
+         << setw(10) << "p99 ns" << setw(12) << "p99.9 ns" << setw(12) << "max ns" << "\n";
+    for(int i = 0; i < 3; i++) {
+        if(lat[i].empty()) continue;
+        size_t count = lat[i].size();
+        cout << left << setw(8) << traceOpNames[i] << right << setprecision(0) << setw(10) << count
+             << setw(10) << percentile(lat[i], 0.5) << setw(10) << percentile(lat[i], 0.9)
+             << setw(10) << percentile(lat[i], 0.99) << setw(12) << percentile(lat[i], 0.999)
+             << setw(12) << percentile(lat[i], 1.0) << "\n";
+    }
+}
+
+int runReplay(const string& path, const string& tree, bool timed) {
+    vector<TraceOp> ops;
+    vector<string> state;
+    if(!readTrace(path, ops, state)) { cout << "Could not read trace " << path << "\n"; return 1; }
+    bool any = false;
+    for(int t = 0; t < 6; t++) {
+        if(!tree.empty() && tree != treeNames[t]) continue;
+        any = true;
+        switch(t) {
+        case TreeManager::BSTType: replayOn<BST>(t, ops, state, timed); break;
+        case TreeManager::AVLType: replayOn<AVL>(t, ops, state, timed); break;
+        case TreeManager::RBType: replayOn<RBTree>(t, ops, state, timed); break;
+        case TreeManager::TDRBType: replayOn<TDRBTree>(t, ops, state, timed); break;
+        case TreeManager::WAVLType: replayOn<WAVLTree>(t, ops, state, timed); break;
+        case TreeManager::SplayType: replayOn<SplayTree>(t, ops, state, timed); break;
+        }
+    }
+    if(!any) { cout << "Unknown tree type: " << tree << " (bst, avl, rb, rbtd, wavl, splay)\n"; return 1; }
+    return 0;
+}
+
+#ifdef __linux__
+// ---------------------
+// Socket server
+// ---------------------
+// "--serve <path>" exposes the trees on a Unix domain socket. Requests are
+// fixed 10-byte frames {u8 op, u8 tree, i32 key, i32 value} (op and tree
+// numbered as in TraceOpKind and TreeManager::TreeType); each gets a 5-byte
+// reply {u8 status, i32 depth} in request order, so clients may pipeline
+// freely. Every frame from one read is run as a batch, the replies leave in
+// one write, and the delta files are flushed once per event-loop pass.
+// A connection gets at most MaxReadsPerPass reads per pass, so one busy
+// client cannot starve the rest, and it is not read at all while more than
+// OutHighWater bytes of its replies are still unsent (a client that
+// pipelines without reading its replies is paused rather than buffered).
+const int RequestSize = 10, ReplySize = 5;
+const int MaxReadsPerPass = 4;
+const size_t OutHighWater = 1 << 20;
+enum ReplyStatus { ReplyOk = 0, ReplyMissing = 1, ReplyBadRequest = 2 };
+
+inline void encodeRequest(char* p, int op, int tree, int key, int value) {
+    p[0] = char(op);
+    p[1] = char(tree);
+    memcpy(p + 2, &key, 4);
+    memcpy(p + 6, &value, 4);
+}
+
+volatile sig_atomic_t serverStop = 0;
+extern "C" void onServerSignal(int) { serverStop = 1; }
+
+struct ServerConn {
+    vector<char> in, out;
+    size_t outPos = 0;
+    uint32_t watching = EPOLLIN;
+    bool readDone = false;  // the client shut down its sending side
+
+    size_t backlog() const { return out.size() - outPos; }
+};
+
+int runServer(TreeManager& m, const string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) { cout << "Socket path too long: " << path << "\n"; return 1; }
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(lfd < 0 || bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0) {
+        perror(path.c_str());
+        return 1;
+    }
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event lev{};
+    lev.events = EPOLLIN;
+    lev.data.fd = lfd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &lev);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onServerSignal);
+    signal(SIGTERM, onServerSignal);
+    cout << "Serving on " << path << ", trees in " << m.dataDir << " (Ctrl-C to stop)\n";
+
+    unordered_map<int, ServerConn> conns;
+    vector<epoll_event> events(256);
+    vector<char> chunk(1 << 16);
+    const int treeCount = sizeof(treeNames) / sizeof(treeNames[0]);
+
+    auto runFrames = [&](ServerConn& c) {
+        size_t used = 0;
+        while(c.in.size() - used >= (size_t)RequestSize) {
+            const char* p = c.in.data() + used;
+            int op = (unsigned char)p[0], tree = (unsigned char)p[1];
+            int key, value, depth = -1;
+            memcpy(&key, p + 2, 4);
+            memcpy(&value, p + 6, 4);
+            unsigned char status = ReplyBadRequest;
+            if(op <= TraceSearch && tree < treeCount) {
+                int r = m.apply((TreeManager::TreeType)tree, op, key, value);
+                status = (r < 0) ? ReplyMissing : ReplyOk;
+                if(op == TraceSearch) depth = r;
+            }
+            c.out.push_back(char(status));
+            c.out.insert(c.out.end(), (char*)&depth, (char*)&depth + 4);
+            used += RequestSize;
+        }
+        c.in.erase(c.in.begin(), c.in.begin() + used);
+    };
+
+    // Writes what the socket will take, watches EPOLLOUT only while replies
+    // are left over and EPOLLIN only while the backlog is below the mark.
+    // Returns false once the connection is finished: a write failed, or the
+    // client has stopped sending and every reply has gone out.
+    auto flushOut = [&](int fd, ServerConn& c) {
+        while(c.outPos < c.out.size()) {
+            ssize_t w = write(fd, c.out.data() + c.outPos, c.out.size() - c.outPos);
+            if(w < 0) {
+                if(errno == EINTR) continue;
+                if(errno == EAGAIN) break;
+                return false;
+            }
+            c.outPos += w;
+        }
+        bool pending = c.outPos < c.out.size();
+        if(!pending && c.readDone) return false;
+        if(!pending) { c.out.clear(); c.outPos = 0; }
+        else if(c.outPos >= c.out.size() / 2) {
+            c.out.erase(c.out.begin(), c.out.begin() + c.outPos);
+            c.outPos = 0;
+        }
+        uint32_t want = 0;
+        if(!c.readDone && c.backlog() < OutHighWater) want |= EPOLLIN;
+        if(pending) want |= EPOLLOUT;
+        if(want != c.watching) {
+            epoll_event e{};
+            e.events = want;
+            e.data.fd = fd;
+            epoll_ctl(ep, EPOLL_CTL_MOD, fd, &e);
+            c.watching = want;
+        }
+        return true;
+    };
+
+    while(!serverStop) {
+        int n = epoll_wait(ep, events.data(), events.size(), 500);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for(int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if(fd == lfd) {
+                int cfd;
+                while((cfd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    epoll_event e{};
+                    e.events = EPOLLIN;
+                    e.data.fd = cfd;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &e);
+                    conns[cfd];
+                }
+                continue;
+            }
+            auto it = conns.find(fd);
+            if(it == conns.end()) continue;
+            ServerConn& c = it->second;
+            bool alive = true;
+            if(events[i].events & EPOLLERR) alive = false;
+            else if(events[i].events & (EPOLLIN | EPOLLHUP)) {
+                // Level-triggered: whatever is left unread is reported
+                // again on the next pass. End of input only stops reading;
+                // the replies already queued are still sent.
+                for(int reads = 0; !c.readDone && reads < MaxReadsPerPass && c.backlog() < OutHighWater; ) {
+                    ssize_t r = read(fd, chunk.data(), chunk.size());
+                    if(r > 0) {
+                        c.in.insert(c.in.end(), chunk.data(), chunk.data() + r);
+                        runFrames(c);
+                        reads++;
+                        continue;
+                    }
+                    if(r < 0 && errno == EINTR) continue;
+                    if(r == 0) c.readDone = true;
+                    else if(errno != EAGAIN) alive = false;
+                    break;
+                }
+            }
+            if(alive) alive = flushOut(fd, c);
+            if(!alive) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                conns.erase(it);
+            }
+        }
+        m.saveDirty();
+    }
+
+    for(auto& kv : conns) close(kv.first);
+    close(ep);
+    close(lfd);
+    unlink(path.c_str());
+    m.saveAll();
+    cout << "Server stopped.\n";
+    return 0;
+}
+
+// ---------------------
+// Load generator
+// ---------------------
+// "--loadgen <path> [tree] [depth] [ops]" drives a running server from 1,
+// 2, 4, 8 and 16 connections. Each connection writes depth requests at a
+// time (half searches, a quarter each inserts and removes, keys uniform in
+// [0, 100000)) and times every reply from the moment its batch was sent.
+bool writeAll(int fd, const char* p, size_t n) {
+    while(n) {
+        ssize_t w = write(fd, p, n);
+        if(w < 0) { if(errno == EINTR) continue; return false; }
+        p += w; n -= w;
+    }
+    return true;
+}
+
+void loadgenWorker(const string& path, int tree, int depth, long long ops, unsigned seed, vector<double>& latUs, bool& ok) {
+    ok = false;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { if(fd >= 0) close(fd); return; }
+    mt19937 rng(seed);
+    vector<char> req(depth * RequestSize), rep(depth * ReplySize);
+    for(long long done = 0; done < ops; ) {
+        int batch = (int)min<long long>(depth, ops - done);
+        for(int i = 0; i < batch; i++) {
+            unsigned r = rng();
+            int op = (r & 3) < 2 ? TraceSearch : ((r & 3) == 2 ? TraceInsert : TraceRemove);
+            int key = (int)((r >> 2) % 100000);
+            encodeRequest(req.data() + i * RequestSize, op, tree, key, key);
+        }
+        auto sent = chrono::steady_clock::now();
+        if(!writeAll(fd, req.data(), batch * RequestSize)) { close(fd); return; }
+        size_t got = 0, counted = 0, want = (size_t)batch * ReplySize;
+        while(got < want) {
+            ssize_t r = read(fd, rep.data() + got, want - got);
+            if(r < 0 && errno == EINTR) continue;
+            if(r <= 0) { close(fd); return; }
+            got += r;
+            double us = chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count();
+            for(; (counted + 1) * ReplySize <= got; counted++) latUs.push_back(us);
+        }
+        done += batch;
+    }
+    close(fd);
+    ok = true;
+}
+
+int runLoadgen(const string& path, const string& treeName, int depth, long long ops) {
+    const int treeCount = sizeof(treeNames) / sizeof(treeNames[0]);
+    int tree = 0;
+    while(tree < treeCount && treeName != treeNames[tree]) tree++;
+    if(tree == treeCount) { cout << "Unknown tree type: " << treeName << "\n"; return 1; }
+    if(depth < 1) depth = 1;
+
+    cout << ops << " requests per level, " << treeName << " tree, pipeline depth " << depth << "\n";
+    cout << "The server keeps these inserts and removes; serve from a scratch --data-dir.\n";
+    cout << setw(6) << "conns" << setw(12) << "Mreq/s" << setw(12) << "p50 us" << setw(12) << "p99 us"
+         << setw(12) << "p99.9 us" << setw(12) << "max us" << "\n";
+    for(int conns : {1, 2, 4, 8, 16}) {
+        vector<vector<double>> lat(conns);
+        vector<char> ok(conns);
+        vector<thread> workers;
+        Stopwatch sw;
+        for(int c = 0; c < conns; c++) {
+            workers.emplace_back([&, c] {
+                bool done;
+                loadgenWorker(path, tree, depth, ops / conns, 1000 + c, lat[c], done);
+                ok[c] = done;
+            });
+        }
+        for(thread& w : workers) w.join();
+        double ms = sw.ms();
+        vector<double> all;
+        for(int c = 0; c < conns; c++) {
+            if(!ok[c]) { cout << "Connection to " << path << " failed\n"; return 1; }
+            all.insert(all.end(), lat[c].begin(), lat[c].end());
+        }
+        cout << setw(6) << conns << fixed << setprecision(3) << setw(12) << all.size() / ms / 1000
+             << setprecision(1) << setw(12) << percentile(all, 0.5) << setw(12) << percentile(all, 0.99)
+             << setw(12) << percentile(all, 0.999) << setw(12) << percentile(all, 1.0) << "\n";
+    }
+    return 0;
+}
+#endif
 
 // ---------------------
 // Main
 // ---------------------
-int main() {
+int main(int argc, char** argv) {
+    if(argc > 2 && string(argv[1]) == "--bench") return runBenchmark(argv[2]);
+    if(argc > 1 && string(argv[1]) == "--check") return runChecks();
+    if(argc > 2 && string(argv[1]) == "--replay") {
+        string tree;
+        bool timed = false;
+        for(int i = 3; i < argc; i++) {
+            if(string(argv[i]) == "--timed") timed = true;
+            else tree = argv[i];
+        }
+        return runReplay(argv[2], tree, timed);
+    }
+#ifdef __linux__
+    if(argc > 2 && string(argv[1]) == "--loadgen") {
+        string tree = argc > 3 ? argv[3] : "rb";
+        int depth = argc > 4 ? atoi(argv[4]) : 32;
+        long long ops = argc > 5 ? atoll(argv[5]) : 200000;
+        return runLoadgen(argv[2], tree, depth, ops);
+    }
+#endif
+
+    // --record, --serve, --data-dir and --bst-rebuild may appear in any
+    // order and combine, e.g. "--serve /tmp/trees.sock --record trace.bin".
     TreeManager manager;
+    TraceRecorder* recorder = nullptr;
+    string servePath;
+    for(int i = 1; i + 1 < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--serve") servePath = argv[++i];
+        else if(arg == "--data-dir") {
+            if(!manager.useDataDir(argv[++i])) { cout<<"Could not use data directory "<<argv[i]<<"\n"; return 1; }
+        }
+        else if(arg == "--record" && !recorder) {
+            recorder = new TraceRecorder(argv[++i]);
+            if(!recorder->ok()) { cout<<"Could not open trace file "<<argv[i]<<"\n"; return 1; }
+        }
+    }
+    for(int i = 1; i < argc; i++) {
+        if(string(argv[i]) != "--bst-rebuild") continue;
+        manager.bst.rebuild = true;
+        if(i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+            double a = atof(argv[i + 1]);
+            if(a > 1) manager.bst.alpha = a;
+            else cout<<"BST rebuild factor must be greater than 1, using "<<manager.bst.alpha<<"\n";
+        }
+    }
     manager.loadAll();
+    if(recorder) manager.startRecording(recorder);
+#ifdef __linux__
+    if(!servePath.empty()) {
+        int rc = runServer(manager, servePath);
+        delete recorder;
+        return rc;
+    }
+#endif
 
     while(true) {
         cout<<"=============================\n";
         cout<<" Welcome to Reactive Trees!  \n";
         cout<<"=============================\n";
         cout<<"Select a tree type:\n";
-        cout<<"1. Binary Search Tree (BST)\n";
-        cout<<"2. AVL Tree\n";
-        cout<<"3. Red-Black Tree\n";
-        cout<<"4. Exit Program\n";
+        cout<<"1. Binary Search Tree (BST) ["<<manager.loadStatus(TreeManager::BSTType)<<"]\n";
+        cout<<"2. AVL Tree ["<<manager.loadStatus(TreeManager::AVLType)<<"]\n";
+        cout<<"3. Red-Black Tree ["<<manager.loadStatus(TreeManager::RBType)<<"]\n";
+        cout<<"4. Red-Black Tree (top-down) ["<<manager.loadStatus(TreeManager::TDRBType)<<"]\n";
+        cout<<"5. Weak AVL Tree (rank-balanced) ["<<manager.loadStatus(TreeManager::WAVLType)<<"]\n";
+        cout<<"6. Splay Tree (self-adjusting) ["<<manager.loadStatus(TreeManager::SplayType)<<"]\n";
+        cout<<"7. Exit Program\n";
         cout<<"Enter number: ";
 
         int treeChoice;
         cin >> treeChoice;
         cin.ignore(); // discard newline
 
-        if(treeChoice == 4) {
+        if(treeChoice == 7) {
             cout<<"Exiting program.\n";
+            manager.saveAll();
+            delete recorder;
             return 0;
         }
 
@@ -876,6 +4014,9 @@ int main() {
             case 1: manager.setTree(TreeManager::BSTType); break;
             case 2: manager.setTree(TreeManager::AVLType); break;
             case 3: manager.setTree(TreeManager::RBType); break;
+            case 4: manager.setTree(TreeManager::TDRBType); break;
+            case 5: manager.setTree(TreeManager::WAVLType); break;
+            case 6: manager.setTree(TreeManager::SplayType); break;
             default: cout<<"Invalid choice, defaulting to BST.\n"; manager.setTree(TreeManager::BSTType); break;
         }
 
@@ -890,31 +4031,47 @@ int main() {
             cout<<"3. Search key\n";
             cout<<"4. Traverse\n";
             cout<<"5. Clear Tree\n";
-            cout<<"6. Back to Tree Selection\n";
-            cout<<"7. Exit Program\n";
+            cout<<"6. Import dataset (CSV or .bin)\n";
+            cout<<"7. Export inorder dataset (CSV or .bin)\n";
+            cout<<"8. Back to Tree Selection\n";
+            cout<<"9. Exit Program\n";
+#ifdef TREE_AGGREGATES
+            cout<<"10. Range aggregate (count/sum/min/max)\n";
+#endif
             cout<<"Enter number: ";
 
             int op;
             cin >> op;
             
-            if(op==7) {
+            if(op==9) {
                 cout<<"Exiting program.\n";
+                manager.saveAll();
+                delete recorder;
                 return 0;
             }
             
-            if(op==6) {
+            if(op==8) {
                 backToTreeSelection = true;
                 manager.clearScreen();
                 continue;
             }
 
             int key;
+#ifdef TREE_AGGREGATES
+            int hi;
+#endif
+            string path;
             switch(op) {
                 case 1: cout<<"Enter key to insert: "; cin>>key; manager.insert(key); break;
                 case 2: cout<<"Enter key to delete: "; cin>>key; manager.remove(key); break;
                 case 3: cout<<"Enter key to search: "; cin>>key; manager.search(key); break;
                 case 4: manager.traverse(); break;
                 case 5: manager.clearTree(); break;
+                case 6: cout<<"Enter file to import: "; cin>>path; manager.importFile(path); break;
+                case 7: cout<<"Enter file to export to: "; cin>>path; manager.exportFile(path); break;
+#ifdef TREE_AGGREGATES
+                case 10: cout<<"Enter range (low high): "; cin>>key>>hi; manager.rangeQuery(key, hi); break;
+#endif
                 default: cout<<"Invalid option.\n"; break;
             }
         }